@@ -0,0 +1,283 @@
+#include "app/drive.h"
+#include "app/escape_table.h"
+#include "common/assert_handler.h"
+#include "common/defines.h"
+#include "motors/motors.h"
+#include <msp430.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Strategy:
+ * A manoeuvre is a sequence of segments, each driving both motors at a fixed
+ * speed for a fixed time. Starting one only sets the motors and remembers
+ * where it is, drive_tick() then counts down the time of the current segment
+ * and moves on to the next one, so the CPU is free to service the sensors in
+ * between and a manoeuvre can be preempted at any point by starting another
+ * one (e.g. from the line reflex). The primitives below are manoeuvres of a
+ * single segment built in RAM, precomputed manoeuvres can be run as-is from
+ * flash with drive_run(). Manoeuvres are posted to the motor arbiter at the
+ * attack level, except for the line escapes which are posted at the line
+ * level. Every level has its own player, so an escape overrides an attack
+ * manoeuvre in the arbiter without ending it, and starting or stopping an
+ * attack manoeuvre never cuts an escape short.
+ */
+
+/* Rough rate the robot spins in place at full speed, used to turn an angle
+ * into a duration. There are no encoders, so spins are estimates. */
+#define DRIVE_SPIN_DEG_PER_S_FULL_SPEED (720UL)
+
+struct drive_player {
+    const struct drive_segment *segments; // NULL if no manoeuvre is running
+    uint8_t segment_cnt;
+    uint8_t segment_idx;
+    uint16_t remaining_ms;
+    bool unlimited;
+    drive_done_cb done_cb;
+};
+
+static bool initialized = false;
+static struct drive_segment primitive; // Segment of the current primitive
+// Indexed by the arbiter level the manoeuvre is posted at
+static struct drive_player players[MOTORS_PRIO_CNT];
+
+void drive_init(void) {
+    ASSERT(!initialized);
+    motors_init();
+    initialized = true;
+}
+
+static void drive_start_segment(motors_prio_enum prio) {
+    struct drive_player *player = &players[prio];
+    const struct drive_segment *segment =
+        &player->segments[player->segment_idx];
+    const struct motors_command command = {
+        .left_speed = segment->left_speed,
+        .right_speed = segment->right_speed,
+        .lifetime_ms = MOTORS_LIFETIME_FOREVER,
+        .unlimited = player->unlimited,
+    };
+    player->remaining_ms = segment->duration_ms;
+    motors_post(prio, &command);
+}
+
+/**
+ * End the current manoeuvre of the level (if any) and start the new one,
+ * returns the callback of the ended manoeuvre, which the caller must call with
+ * interrupts in their previous state.
+ */
+static drive_done_cb drive_replace(motors_prio_enum prio,
+                                   const struct drive_segment *new_segments,
+                                   uint8_t new_segment_cnt,
+                                   bool new_unlimited, drive_done_cb cb) {
+    struct drive_player *player = &players[prio];
+    drive_done_cb preempted_cb = player->segments ? player->done_cb : NULL;
+    if (player->segments && !new_segments) {
+        motors_release(prio);
+    }
+    player->segments = new_segments;
+    player->segment_cnt = new_segment_cnt;
+    player->segment_idx = 0;
+    player->unlimited = new_unlimited;
+    player->done_cb = cb;
+    if (new_segments) {
+        drive_start_segment(prio);
+    }
+    return preempted_cb;
+}
+
+static void drive_start(motors_prio_enum prio,
+                        const struct drive_segment *new_segments,
+                        uint8_t new_segment_cnt, bool new_unlimited,
+                        drive_done_cb cb) {
+    ASSERT(initialized);
+    ASSERT(new_segments);
+    ASSERT(new_segment_cnt > 0);
+    drive_done_cb preempted_cb;
+    {
+        CRITICAL_SECTION_BEGIN();
+        preempted_cb = drive_replace(prio, new_segments, new_segment_cnt,
+                                     new_unlimited, cb);
+        CRITICAL_SECTION_END();
+    }
+    if (preempted_cb) {
+        preempted_cb(false);
+    }
+}
+
+/**
+ * Run a manoeuvre of segment_cnt segments. The segments aren't copied, so
+ * they must stay valid until the manoeuvre ends (e.g. const tables in flash).
+ * Unlimited bypasses the slew limiter for emergencies.
+ */
+void drive_run(const struct drive_segment *new_segments,
+               uint8_t new_segment_cnt, bool new_unlimited,
+               drive_done_cb cb) {
+    drive_start(MOTORS_PRIO_ATTACK, new_segments, new_segment_cnt,
+                new_unlimited, cb);
+}
+
+/**
+ * Run the precomputed escape manoeuvre for the line (see escape_table.h),
+ * angle is the crossing angle in deci-degrees or ESCAPE_ANGLE_UNKNOWN. Only
+ * indexes the table in flash, so it's cheap enough for the line reflex.
+ * Returns false (and leaves the current manoeuvre running) if the line needs
+ * no escape.
+ */
+bool drive_escape(e__line line, int16_t angle, drive_done_cb cb) {
+    ASSERT((line < ESCAPE_LINE_CNT));
+    if (angle >= ESCAPE_ANGLE_MAX) {
+        angle = ESCAPE_ANGLE_MAX - 1;
+    } else if (angle < -ESCAPE_ANGLE_MAX) {
+        angle = -ESCAPE_ANGLE_MAX;
+    }
+    const uint8_t angle_bin =
+        (uint16_t)(angle + ESCAPE_ANGLE_MAX) / ESCAPE_ANGLE_BIN_WIDTH;
+    const struct escape_entry *entry = &escape_table[line][angle_bin];
+    if (!entry->segments) {
+        return false;
+    }
+    drive_start(MOTORS_PRIO_LINE, entry->segments, entry->segment_cnt, true,
+                cb);
+    return true;
+}
+
+static void drive_primitive(int16_t left_speed, int16_t right_speed,
+                            uint16_t duration_ms, drive_done_cb cb) {
+    ASSERT(initialized);
+    drive_done_cb preempted_cb;
+    {
+        CRITICAL_SECTION_BEGIN();
+        primitive.left_speed = left_speed;
+        primitive.right_speed = right_speed;
+        primitive.duration_ms = duration_ms;
+        preempted_cb =
+            drive_replace(MOTORS_PRIO_ATTACK, &primitive, 1, false, cb);
+        CRITICAL_SECTION_END();
+    }
+    if (preempted_cb) {
+        preempted_cb(false);
+    }
+}
+
+/**
+ * End the current attack manoeuvre (started with drive_run() or a primitive)
+ * and release its level, a line escape in progress runs on
+ */
+void drive_stop(void) {
+    ASSERT(initialized);
+    drive_done_cb preempted_cb;
+    {
+        CRITICAL_SECTION_BEGIN();
+        preempted_cb = drive_replace(MOTORS_PRIO_ATTACK, NULL, 0, false, NULL);
+        CRITICAL_SECTION_END();
+    }
+    if (preempted_cb) {
+        preempted_cb(false);
+    }
+}
+
+/**
+ * Advance the current manoeuvre of every level, call every DRIVE_TICK_MS
+ */
+void drive_tick(void) {
+    ASSERT(initialized);
+    drive_done_cb completed_cbs[MOTORS_PRIO_CNT] = {NULL};
+    {
+        CRITICAL_SECTION_BEGIN();
+        for (motors_prio_enum prio = 0; prio < MOTORS_PRIO_CNT; prio++) {
+            struct drive_player *player = &players[prio];
+            if (!player->segments || player->remaining_ms == DRIVE_FOREVER) {
+                continue;
+            }
+            player->remaining_ms = player->remaining_ms > DRIVE_TICK_MS
+                                       ? player->remaining_ms - DRIVE_TICK_MS
+                                       : 0;
+            if (player->remaining_ms) {
+                continue;
+            }
+            if (++player->segment_idx < player->segment_cnt) {
+                drive_start_segment(prio);
+            } else {
+                completed_cbs[prio] = player->done_cb;
+                drive_replace(prio, NULL, 0, false, NULL);
+            }
+        }
+        CRITICAL_SECTION_END();
+    }
+    for (motors_prio_enum prio = 0; prio < MOTORS_PRIO_CNT; prio++) {
+        if (completed_cbs[prio]) {
+            completed_cbs[prio](true);
+        }
+    }
+}
+
+/**
+ * True while a manoeuvre of any level is running
+ */
+bool drive_is_busy(void) {
+    for (motors_prio_enum prio = 0; prio < MOTORS_PRIO_CNT; prio++) {
+        if (players[prio].segments) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void drive_forward(uint16_t speed, uint16_t duration_ms, drive_done_cb cb) {
+    drive_primitive(speed, speed, duration_ms, cb);
+}
+
+void drive_reverse(uint16_t speed, uint16_t duration_ms, drive_done_cb cb) {
+    drive_primitive(-(int16_t)speed, -(int16_t)speed, duration_ms, cb);
+}
+
+/**
+ * Turn in place, the wheels run at the same speed in opposite directions
+ */
+void drive_pivot(drive_dir_enum dir, uint16_t speed, uint16_t duration_ms,
+                 drive_done_cb cb) {
+    const int16_t forward = speed;
+    const int16_t backward = -(int16_t)speed;
+    if (dir == DRIVE_DIR_LEFT) {
+        drive_primitive(backward, forward, duration_ms, cb);
+    } else {
+        drive_primitive(forward, backward, duration_ms, cb);
+    }
+}
+
+/**
+ * Drive forward in an arc, the inner wheel runs at inner_ratio (permille) of
+ * the speed of the outer wheel
+ */
+void drive_arc(drive_dir_enum dir, uint16_t speed, uint16_t inner_ratio,
+               uint16_t duration_ms, drive_done_cb cb) {
+    ASSERT((inner_ratio <= 1000U));
+    const int16_t outer = speed;
+    const int16_t inner = ((uint32_t)speed * inner_ratio) / 1000U;
+    if (dir == DRIVE_DIR_LEFT) {
+        drive_primitive(inner, outer, duration_ms, cb);
+    } else {
+        drive_primitive(outer, inner, duration_ms, cb);
+    }
+}
+
+/**
+ * Pivot by roughly the given angle (degrees, positive is left), the duration
+ * is estimated from the speed
+ */
+void drive_spin(int16_t angle, uint16_t speed, drive_done_cb cb) {
+    ASSERT(speed > 0);
+    const uint32_t abs_angle = angle < 0 ? -(int32_t)angle : angle;
+    const uint32_t full_speed_ms =
+        (abs_angle * 1000UL) / DRIVE_SPIN_DEG_PER_S_FULL_SPEED;
+    uint32_t duration_ms = (full_speed_ms * MOTORS_SPEED_MAX) / speed;
+    if (duration_ms == 0) {
+        duration_ms = DRIVE_TICK_MS; // DRIVE_FOREVER would never stop
+    } else if (duration_ms > UINT16_MAX) {
+        duration_ms = UINT16_MAX;
+    }
+    drive_pivot(angle < 0 ? DRIVE_DIR_RIGHT : DRIVE_DIR_LEFT, speed,
+                (uint16_t)duration_ms, cb);
+}
@@ -0,0 +1,42 @@
+#ifndef DRIVE_H
+#define DRIVE_H
+#include "app/line.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// drive_tick() must be called with this period
+#define DRIVE_TICK_MS (1U)
+// Duration of a segment that runs until it's preempted
+#define DRIVE_FOREVER (0U)
+
+// Speeds are in permille (see MOTORS_SPEED_MAX), positive is forward
+struct drive_segment {
+    int16_t left_speed;
+    int16_t right_speed;
+    uint16_t duration_ms;
+};
+
+typedef enum { DRIVE_DIR_LEFT, DRIVE_DIR_RIGHT } drive_dir_enum;
+
+/* Called when a manoeuvre ends, completed is false if it was preempted by
+ * another manoeuvre of the same level (attack or line escape) or by
+ * drive_stop(). Runs in the context that ended it (the caller of drive_tick()
+ * or of the preempting function). */
+typedef void (*drive_done_cb)(bool completed);
+
+void drive_init(void);
+void drive_tick(void);
+void drive_forward(uint16_t speed, uint16_t duration_ms, drive_done_cb cb);
+void drive_reverse(uint16_t speed, uint16_t duration_ms, drive_done_cb cb);
+void drive_pivot(drive_dir_enum dir, uint16_t speed, uint16_t duration_ms,
+                 drive_done_cb cb);
+void drive_arc(drive_dir_enum dir, uint16_t speed, uint16_t inner_ratio,
+               uint16_t duration_ms, drive_done_cb cb);
+void drive_spin(int16_t angle, uint16_t speed, drive_done_cb cb);
+void drive_run(const struct drive_segment *segments, uint8_t segment_cnt,
+               bool unlimited, drive_done_cb cb);
+bool drive_escape(e__line line, int16_t angle, drive_done_cb cb);
+void drive_stop(void);
+bool drive_is_busy(void);
+
+#endif // DRIVE_H
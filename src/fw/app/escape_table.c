@@ -0,0 +1,160 @@
+// Generated by tools/gen_escape_table.py, do not edit
+#include "app/escape_table.h"
+#include <assert.h>
+#include <stddef.h>
+
+static_assert(ESCAPE_LINE_CNT == 11, "Out of sync with generator");
+static_assert(ESCAPE_ANGLE_BIN_CNT == 5, "Out of sync with generator");
+static_assert(ESCAPE_ANGLE_BIN_WIDTH == 300, "Out of sync with generator");
+
+static const struct drive_segment escape_front_0[] = {
+    {-900, -900, 200},
+    {-800, 800, 208},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_front_1[] = {
+    {-900, -900, 200},
+    {-800, 800, 260},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_front_2[] = {
+    {-900, -900, 200},
+    {800, -800, 312},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_front_3[] = {
+    {-900, -900, 200},
+    {800, -800, 260},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_front_4[] = {
+    {-900, -900, 200},
+    {800, -800, 208},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_back_0[] = {
+    {900, 900, 250},
+    {800, -800, 52},
+};
+static const struct drive_segment escape_back_1[] = {
+    {900, 900, 250},
+    {800, -800, 26},
+};
+static const struct drive_segment escape_back_2[] = {
+    {900, 900, 250},
+};
+static const struct drive_segment escape_back_3[] = {
+    {900, 900, 250},
+    {-800, 800, 26},
+};
+static const struct drive_segment escape_back_4[] = {
+    {900, 900, 250},
+    {-800, 800, 52},
+};
+static const struct drive_segment escape_left_0[] = {
+    {900, 270, 300},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_right_0[] = {
+    {270, 900, 300},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_front_left_0[] = {
+    {-900, -900, 200},
+    {800, -800, 234},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_front_right_0[] = {
+    {-900, -900, 200},
+    {-800, 800, 234},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_diagonal_left_0[] = {
+    {800, -800, 156},
+    {900, 900, 250},
+};
+static const struct drive_segment escape_diagonal_right_0[] = {
+    {-800, 800, 156},
+    {900, 900, 250},
+};
+
+const struct escape_entry
+    escape_table[ESCAPE_LINE_CNT][ESCAPE_ANGLE_BIN_CNT] = {
+    [LINE_NONE] = {
+        {NULL, 0},
+        {NULL, 0},
+        {NULL, 0},
+        {NULL, 0},
+        {NULL, 0},
+    },
+    [LINE_FRONT] = {
+        {escape_front_0, 3},
+        {escape_front_1, 3},
+        {escape_front_2, 3},
+        {escape_front_3, 3},
+        {escape_front_4, 3},
+    },
+    [LINE_BACK] = {
+        {escape_back_0, 2},
+        {escape_back_1, 2},
+        {escape_back_2, 1},
+        {escape_back_3, 2},
+        {escape_back_4, 2},
+    },
+    [LINE_LEFT] = {
+        {escape_left_0, 2},
+        {escape_left_0, 2},
+        {escape_left_0, 2},
+        {escape_left_0, 2},
+        {escape_left_0, 2},
+    },
+    [LINE_RIGHT] = {
+        {escape_right_0, 2},
+        {escape_right_0, 2},
+        {escape_right_0, 2},
+        {escape_right_0, 2},
+        {escape_right_0, 2},
+    },
+    [LINE_FRONT_LEFT] = {
+        {escape_front_left_0, 3},
+        {escape_front_left_0, 3},
+        {escape_front_left_0, 3},
+        {escape_front_left_0, 3},
+        {escape_front_left_0, 3},
+    },
+    [LINE_FRONT_RIGHT] = {
+        {escape_front_right_0, 3},
+        {escape_front_right_0, 3},
+        {escape_front_right_0, 3},
+        {escape_front_right_0, 3},
+        {escape_front_right_0, 3},
+    },
+    [LINE_BACK_LEFT] = {
+        {escape_left_0, 2},
+        {escape_left_0, 2},
+        {escape_left_0, 2},
+        {escape_left_0, 2},
+        {escape_left_0, 2},
+    },
+    [LINE_BACK_RIGHT] = {
+        {escape_right_0, 2},
+        {escape_right_0, 2},
+        {escape_right_0, 2},
+        {escape_right_0, 2},
+        {escape_right_0, 2},
+    },
+    [LINE_DIAGONAL_LEFT] = {
+        {escape_diagonal_left_0, 2},
+        {escape_diagonal_left_0, 2},
+        {escape_diagonal_left_0, 2},
+        {escape_diagonal_left_0, 2},
+        {escape_diagonal_left_0, 2},
+    },
+    [LINE_DIAGONAL_RIGHT] = {
+        {escape_diagonal_right_0, 2},
+        {escape_diagonal_right_0, 2},
+        {escape_diagonal_right_0, 2},
+        {escape_diagonal_right_0, 2},
+        {escape_diagonal_right_0, 2},
+    },
+};
@@ -0,0 +1,28 @@
+#ifndef ESCAPE_TABLE_H
+#define ESCAPE_TABLE_H
+#include "app/drive.h"
+#include "app/line.h"
+#include <stdint.h>
+
+/* Precomputed manoeuvres to get away from the line, generated by
+ * tools/gen_escape_table.py into escape_table.c (don't edit it by hand). */
+
+#define ESCAPE_LINE_CNT (LINE_DIAGONAL_RIGHT + 1)
+
+// The crossing angle (deci-degrees, see line_crossing) is split into bins of
+// this width centered on 0, angles beyond the outer bins fall into them
+#define ESCAPE_ANGLE_BIN_CNT (5)
+#define ESCAPE_ANGLE_BIN_WIDTH (300)
+#define ESCAPE_ANGLE_MAX (ESCAPE_ANGLE_BIN_CNT * ESCAPE_ANGLE_BIN_WIDTH / 2)
+// Angle to pass when the crossing couldn't be estimated
+#define ESCAPE_ANGLE_UNKNOWN (0)
+
+struct escape_entry {
+    const struct drive_segment *segments; // NULL if there is nothing to do
+    uint8_t segment_cnt;
+};
+
+extern const struct escape_entry escape_table[ESCAPE_LINE_CNT]
+                                             [ESCAPE_ANGLE_BIN_CNT];
+
+#endif // ESCAPE_TABLE_H
@@ -1,59 +1,371 @@
 #include "app/line.h"
 #include "common/assert_handler.h"
+#include "common/event.h"
+#include "common/prof.h"
+#include "drivers/debug_marker.h"
 #include "drivers/qre1113.h"
+#include <assert.h>
+#include <msp430.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The threshold comparison is done directly in the ADC DMA ISR for every
+ * completed sequence instead of when line_get() is called. That way a line is
+ * detected at most LINE_DETECT_SEQUENCES_MAX ADC sequences after the sensor
+ * sees it (one to complete the sequence, plus the debounce below), independent
+ * of how often the application polls, and a registered reflex can act on it
+ * right away.
+ *
+ * Each sensor has its own thresholds because the surface, lighting and sensor
+ * height differ per sensor and per dohyo. line_calibrate() samples the black
+ * surface to learn a baseline and noise floor per sensor, from which an enter
+ * and exit threshold (hysteresis) are derived. During the match the baseline
+ * follows slow drift while the sensor sees black.
+ *
+ * The comparator output of each sensor is debounced (N hits out of the last M
+ * sequences) and the debounced sensors are packed into a mask (bit n =
+ * e__qre1113_pos n) that indexes a lookup table of e__line values. Changes of
+ * the mask are kept in a small history timestamped with the ADC sequence
+ * count, so the escape logic can tell which sensor saw the line first.
+ */
+
+// Thresholds used until line_calibrate() has been called
+#define LINE_DEFAULT_ENTER_THRESHOLD (700U)
+#define LINE_DEFAULT_EXIT_THRESHOLD (750U)
+
+// Number of ADC sequences averaged during calibration (power of 2)
+#define LINE_CALIBRATION_SAMPLES_SHIFT (6U)
+#define LINE_CALIBRATION_SAMPLES (1U << LINE_CALIBRATION_SAMPLES_SHIFT)
+
+// The line must be at least this far below the baseline (or a multiple of the
+// noise floor if that is larger) to be detected
+#define LINE_MIN_ENTER_MARGIN (200U)
+#define LINE_NOISE_ENTER_GAIN (4U)
+// Distance between the enter and exit threshold
+#define LINE_MIN_HYSTERESIS (50U)
+#define LINE_NOISE_HYSTERESIS_GAIN (2U)
+
+// The baseline moves 1 count towards the measured voltage every N sequences
+// (~125 counts/s), slow enough to ignore anything but drift
+#define LINE_BASELINE_TRACK_SEQUENCES (16U)
+
+// A sensor is detected once LINE_DEBOUNCE_N of the last LINE_DEBOUNCE_M
+// comparator outputs are hits, and released once N of the last M are misses.
+// This delays detection by up to N - 1 sequences.
+#define LINE_DEBOUNCE_M (4U)
+#define LINE_DEBOUNCE_N (3U)
+#define LINE_DEBOUNCE_WINDOW_MASK ((1U << LINE_DEBOUNCE_M) - 1U)
+static_assert(LINE_DEBOUNCE_M <= 4U, "Lookup tables only cover 4 bits");
+static_assert(LINE_DEBOUNCE_N <= LINE_DEBOUNCE_M, "Invalid N-of-M debounce");
+static_assert(LINE_DETECT_SEQUENCES_MAX == 1U + (LINE_DEBOUNCE_N - 1U),
+              "Detection latency doesn't match the debounce");
+
+#define LINE_MASK_FL (1U << QRE1113_POS_FRONT_LEFT)
+#define LINE_MASK_FR (1U << QRE1113_POS_FRONT_RIGHT)
+#define LINE_MASK_BL (1U << QRE1113_POS_BACK_LEFT)
+#define LINE_MASK_BR (1U << QRE1113_POS_BACK_RIGHT)
+
+/* Detected sensors -> line. With 3 or more sensors detected the front takes
+ * precedence over the sides, and the sides over the back */
+static const e__line line_from_mask[1U << QRE1113_POS_CNT] = {
+    [0] = LINE_NONE,
+    [LINE_MASK_FL] = LINE_FRONT_LEFT,
+    [LINE_MASK_FR] = LINE_FRONT_RIGHT,
+    [LINE_MASK_BL] = LINE_BACK_LEFT,
+    [LINE_MASK_BR] = LINE_BACK_RIGHT,
+    [LINE_MASK_FL | LINE_MASK_FR] = LINE_FRONT,
+    [LINE_MASK_BL | LINE_MASK_BR] = LINE_BACK,
+    [LINE_MASK_FL | LINE_MASK_BL] = LINE_LEFT,
+    [LINE_MASK_FR | LINE_MASK_BR] = LINE_RIGHT,
+    [LINE_MASK_FL | LINE_MASK_BR] = LINE_DIAGONAL_LEFT,
+    [LINE_MASK_FR | LINE_MASK_BL] = LINE_DIAGONAL_RIGHT,
+    [LINE_MASK_FL | LINE_MASK_FR | LINE_MASK_BL] = LINE_FRONT,
+    [LINE_MASK_FL | LINE_MASK_FR | LINE_MASK_BR] = LINE_FRONT,
+    [LINE_MASK_FL | LINE_MASK_BL | LINE_MASK_BR] = LINE_LEFT,
+    [LINE_MASK_FR | LINE_MASK_BL | LINE_MASK_BR] = LINE_RIGHT,
+    [LINE_MASK_FL | LINE_MASK_FR | LINE_MASK_BL | LINE_MASK_BR] = LINE_FRONT};
+
+// Number of hits in a debounce window
+static const uint8_t window_hit_cnt[1U << LINE_DEBOUNCE_M] = {
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+// Age in sequences of the oldest hit in a debounce window (bit 0 = newest)
+static const uint8_t window_oldest_hit_age[1U << LINE_DEBOUNCE_M] = {
+    0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3};
+
+struct line_sensor_state {
+    struct line_sensor_calibration calibration;
+    uint16_t enter_margin; // baseline - enter_threshold
+    bool raw_detected;     // Comparator output (with hysteresis)
+    uint8_t window;        // Last M comparator outputs, bit 0 = newest
+    bool detected;         // Debounced
+    uint32_t onset;        // Sequence when the sensor first saw the line
+    // Calibration accumulators
+    uint32_t sum;
+    uint16_t min;
+    uint16_t max;
+};
 
-#define LINE_DETECTED_VOLTAGE_THRESHOLD (700U);
 static bool initialized = false;
+static volatile e__line latest_line = LINE_NONE;
+static line_reflex_cb reflex_cb = NULL;
+static struct line_sensor_state sensors[QRE1113_POS_CNT];
+static volatile uint8_t calibration_samples_left = 0;
+static bool calibrated = false;
+static uint8_t baseline_track_cnt = 0;
+static volatile uint32_t sequence_cnt = 0;
+static uint8_t latest_mask = 0;
+static struct line_event history[LINE_HISTORY_LEN];
+static uint8_t history_idx = 0; // Index of the next event to write
+static uint8_t history_cnt = 0;
 
-void line_init(void) {
-    ASSERT(!initialized);
-    qre1113_init();
-    initialized = true;
+static inline uint16_t line_max(uint16_t a, uint16_t b) {
+    return a > b ? a : b;
 }
 
-e__line line_get(void) {
-    struct qre1113_voltages voltages;
-    qre1113_get_voltages(&voltages);
-
-    // Constants to indicate if line was detected by corresponding qre1113
-    // sensor
-    const bool front_left_detected =
-        voltages.front_left < LINE_DETECTED_VOLTAGE_THRESHOLD;
-    const bool front_right_detected =
-        voltages.front_right < LINE_DETECTED_VOLTAGE_THRESHOLD;
-    const bool back_left_detected =
-        voltages.back_left < LINE_DETECTED_VOLTAGE_THRESHOLD;
-    const bool back_right_detected =
-        voltages.back_right < LINE_DETECTED_VOLTAGE_THRESHOLD;
-
-    if (front_left_detected) {
-        if (front_right_detected) {
-            return LINE_FRONT;
-        } else if (back_left_detected) {
-            return LINE_LEFT;
-        } else if (back_right_detected) {
-            return LINE_DIAGONAL_LEFT;
-        } else {
-            return LINE_FRONT_LEFT;
+/**
+ * Derive the enter/exit thresholds of a sensor from its baseline and noise
+ */
+static void line_sensor_set_thresholds(struct line_sensor_state *sensor) {
+    struct line_sensor_calibration *cal = &sensor->calibration;
+    const uint16_t hysteresis = line_max(
+        LINE_MIN_HYSTERESIS, LINE_NOISE_HYSTERESIS_GAIN * cal->noise);
+    sensor->enter_margin =
+        line_max(LINE_MIN_ENTER_MARGIN, LINE_NOISE_ENTER_GAIN * cal->noise) +
+        hysteresis;
+    if (sensor->enter_margin > cal->baseline) {
+        // Baseline too close to white to tell the two apart, never detect
+        // rather than always detect
+        sensor->enter_margin = cal->baseline;
+    }
+    cal->enter_threshold = cal->baseline - sensor->enter_margin;
+    cal->exit_threshold = cal->enter_threshold + hysteresis;
+}
+
+/**
+ * Follow slow drift of the black surface voltage (temperature, dust, ...)
+ */
+static inline void line_sensor_track_baseline(struct line_sensor_state *sensor,
+                                              uint16_t voltage) {
+    struct line_sensor_calibration *cal = &sensor->calibration;
+    if (voltage > cal->baseline) {
+        cal->baseline++;
+    } else if (voltage < cal->baseline &&
+               cal->baseline > sensor->enter_margin) {
+        cal->baseline--;
+    } else {
+        return;
+    }
+    const uint16_t hysteresis = cal->exit_threshold - cal->enter_threshold;
+    cal->enter_threshold = cal->baseline - sensor->enter_margin;
+    cal->exit_threshold = cal->enter_threshold + hysteresis;
+}
+
+static void line_calibration_sample(const volatile uint16_t *voltages) {
+    for (uint8_t i = 0; i < QRE1113_POS_CNT; i++) {
+        struct line_sensor_state *sensor = &sensors[i];
+        const uint16_t voltage = voltages[i];
+        sensor->sum += voltage;
+        if (voltage < sensor->min) {
+            sensor->min = voltage;
         }
-    } else if (front_right_detected) {
-        if (back_right_detected) {
-            return LINE_RIGHT;
-        } else if (back_left_detected) {
-            return LINE_DIAGONAL_RIGHT;
+        if (voltage > sensor->max) {
+            sensor->max = voltage;
+        }
+    }
+
+    calibration_samples_left--;
+    if (calibration_samples_left) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < QRE1113_POS_CNT; i++) {
+        struct line_sensor_state *sensor = &sensors[i];
+        struct line_sensor_calibration *cal = &sensor->calibration;
+        cal->baseline =
+            (uint16_t)(sensor->sum >> LINE_CALIBRATION_SAMPLES_SHIFT);
+        cal->noise = line_max(sensor->max - cal->baseline,
+                              cal->baseline - sensor->min);
+        line_sensor_set_thresholds(sensor);
+    }
+    calibrated = true;
+}
+
+/**
+ * Runs in the ADC DMA ISR after every completed sequence
+ */
+static void line_voltages_isr(const volatile uint16_t *voltages) {
+    if (calibration_samples_left) {
+        line_calibration_sample(voltages);
+        return;
+    }
+
+    PROF_BEGIN(PROF_LINE_CLASSIFY);
+    bool track_baseline = false;
+    if (calibrated && ++baseline_track_cnt >= LINE_BASELINE_TRACK_SEQUENCES) {
+        baseline_track_cnt = 0;
+        track_baseline = true;
+    }
+
+    const uint32_t sequence = ++sequence_cnt;
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < QRE1113_POS_CNT; i++) {
+        struct line_sensor_state *sensor = &sensors[i];
+        const uint16_t voltage = voltages[i];
+        // Hysteresis, a detected sensor must rise above the exit threshold
+        // before it is considered on black again
+        if (sensor->raw_detected) {
+            sensor->raw_detected = voltage < sensor->calibration.exit_threshold;
         } else {
-            return LINE_FRONT_RIGHT;
+            sensor->raw_detected =
+                voltage < sensor->calibration.enter_threshold;
+            if (track_baseline && !sensor->raw_detected &&
+                voltage >= sensor->calibration.exit_threshold) {
+                line_sensor_track_baseline(sensor, voltage);
+            }
         }
-    } else if (back_left_detected) {
-        if (back_right_detected) {
-            return LINE_BACK;
+
+        sensor->window = ((sensor->window << 1) | sensor->raw_detected) &
+                         LINE_DEBOUNCE_WINDOW_MASK;
+        const uint8_t hits = window_hit_cnt[sensor->window];
+        if (!sensor->detected && hits >= LINE_DEBOUNCE_N) {
+            sensor->detected = true;
+            sensor->onset = sequence - window_oldest_hit_age[sensor->window];
+        } else if (sensor->detected &&
+                   hits <= LINE_DEBOUNCE_M - LINE_DEBOUNCE_N) {
+            sensor->detected = false;
+        }
+        mask |= (uint8_t)(sensor->detected << i);
+    }
+
+    if (mask != latest_mask) {
+        latest_mask = mask;
+        history[history_idx].timestamp = sequence;
+        history[history_idx].mask = mask;
+        history_idx = (history_idx + 1) % LINE_HISTORY_LEN;
+        if (history_cnt < LINE_HISTORY_LEN) {
+            history_cnt++;
+        }
+    }
+
+    const e__line line = line_from_mask[mask];
+    if (line != latest_line) {
+        if (line != LINE_NONE) {
+            DEBUG_MARKER_HIGH(DEBUG_MARKER_LINE);
         } else {
-            return LINE_BACK_LEFT;
+            DEBUG_MARKER_LOW(DEBUG_MARKER_LINE);
         }
-    } else if (back_right_detected) {
-        return LINE_BACK_RIGHT;
-    } else {
-        return LINE_NONE;
+        latest_line = line;
+        if (reflex_cb) {
+            reflex_cb(line);
+        }
+        event_post(EVENT_LINE, line);
+    }
+    PROF_END(PROF_LINE_CLASSIFY);
+}
+
+void line_init(void) {
+    ASSERT(!initialized);
+    for (uint8_t i = 0; i < QRE1113_POS_CNT; i++) {
+        struct line_sensor_calibration *cal = &sensors[i].calibration;
+        cal->enter_threshold = LINE_DEFAULT_ENTER_THRESHOLD;
+        cal->exit_threshold = LINE_DEFAULT_EXIT_THRESHOLD;
+        cal->baseline = 0;
+        cal->noise = 0;
+        sensors[i].enter_margin = 0;
+        sensors[i].raw_detected = false;
+        sensors[i].window = 0;
+        sensors[i].detected = false;
+        sensors[i].onset = 0;
+    }
+    qre1113_init();
+    qre1113_register_voltages_cb(line_voltages_isr);
+    initialized = true;
+}
+
+/**
+ * Returns the line classification of the latest ADC sequence
+ */
+e__line line_get(void) {
+    ASSERT(initialized);
+    return latest_line;
+}
+
+/**
+ * Register a function to be called (from ISR context) every time the line
+ * classification changes
+ */
+void line_register_reflex(line_reflex_cb cb) {
+    ASSERT(initialized);
+    reflex_cb = cb;
+}
+
+/**
+ * Learn the baseline and noise floor of each sensor and derive its thresholds
+ * @note Blocks for LINE_CALIBRATION_SAMPLES ADC sequences (~32ms). All sensors
+ * must be on the black surface (e.g. robot placed in the middle of the dohyo).
+ */
+void line_calibrate(void) {
+    ASSERT(initialized);
+    __disable_interrupt();
+    for (uint8_t i = 0; i < QRE1113_POS_CNT; i++) {
+        sensors[i].sum = 0;
+        sensors[i].min = UINT16_MAX;
+        sensors[i].max = 0;
+    }
+    calibration_samples_left = LINE_CALIBRATION_SAMPLES;
+    __enable_interrupt();
+    // Sampling is done by the ADC DMA ISR
+    while (calibration_samples_left) {
+    }
+}
+
+void line_get_calibration(e__qre1113_pos pos,
+                          struct line_sensor_calibration *calibration) {
+    ASSERT(initialized);
+    __disable_interrupt();
+    *calibration = sensors[pos].calibration;
+    __enable_interrupt();
+}
+
+/**
+ * Get the ADC sequence (timestamp) at which a sensor started seeing the line
+ * @return false if the sensor currently doesn't see the line
+ */
+bool line_get_sensor_onset(e__qre1113_pos pos, uint32_t *timestamp) {
+    ASSERT(initialized);
+    __disable_interrupt();
+    const bool detected = sensors[pos].detected;
+    *timestamp = sensors[pos].onset;
+    __enable_interrupt();
+    return detected;
+}
+
+/**
+ * Returns the current timestamp (number of ADC sequences processed)
+ */
+uint32_t line_get_timestamp(void) {
+    ASSERT(initialized);
+    __disable_interrupt();
+    const uint32_t timestamp = sequence_cnt;
+    __enable_interrupt();
+    return timestamp;
+}
+
+/**
+ * Copy the latest changes of the detected sensors, newest first
+ * @return number of events copied (at most max_cnt)
+ */
+uint8_t line_get_history(struct line_event *events, uint8_t max_cnt) {
+    ASSERT(initialized);
+    __disable_interrupt();
+    const uint8_t cnt = history_cnt < max_cnt ? history_cnt : max_cnt;
+    uint8_t idx = history_idx;
+    for (uint8_t i = 0; i < cnt; i++) {
+        idx = (idx + LINE_HISTORY_LEN - 1) % LINE_HISTORY_LEN;
+        events[i] = history[idx];
     }
+    __enable_interrupt();
+    return cnt;
 }
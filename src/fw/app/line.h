@@ -1,3 +1,8 @@
+#ifndef LINE_H
+#define LINE_H
+#include "drivers/qre1113.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 typedef enum {
     LINE_NONE,          // No line
@@ -15,5 +20,41 @@ typedef enum {
                         // sensor
 } e__line;
 
+// Per-sensor thresholds derived from calibration (voltages in ADC counts)
+struct line_sensor_calibration {
+    uint16_t baseline;        // Voltage on the black surface (tracked)
+    uint16_t noise;           // Peak deviation from baseline at calibration
+    uint16_t enter_threshold; // Below this the sensor starts seeing the line
+    uint16_t exit_threshold;  // Above this the sensor stops seeing the line
+};
+
+// A line is detected (and the reflex called) at most this many ADC sequences
+// (ADC_SEQUENCE_PERIOD_US) after a sensor sees it, one to complete the
+// sequence and the rest for the debounce
+#define LINE_DETECT_SEQUENCES_MAX (3U)
+
+// Changes of the detected sensors are kept in a history of this length
+#define LINE_HISTORY_LEN (8U)
+
+struct line_event {
+    uint32_t timestamp; // ADC sequence count (see ADC_SEQUENCE_PERIOD_US)
+    uint8_t mask;       // Detected sensors after the change, bit n =
+                        // e__qre1113_pos n
+};
+
+/* Called from the ADC DMA ISR as soon as the line classification changes, so
+ * the caller can react (e.g. reverse the motors) without waiting for the main
+ * loop to call line_get(). Must be short since it runs in ISR context. */
+typedef void (*line_reflex_cb)(e__line line);
+
 void line_init(void);
 e__line line_get(void);
+void line_register_reflex(line_reflex_cb cb);
+void line_calibrate(void);
+void line_get_calibration(e__qre1113_pos pos,
+                          struct line_sensor_calibration *calibration);
+bool line_get_sensor_onset(e__qre1113_pos pos, uint32_t *timestamp);
+uint32_t line_get_timestamp(void);
+uint8_t line_get_history(struct line_event *events, uint8_t max_cnt);
+
+#endif // LINE_H
@@ -0,0 +1,116 @@
+#include "app/line_geometry.h"
+#include "app/line.h"
+#include "drivers/adc.h"
+#include "drivers/qre1113.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The edge is treated as a straight line crossed at angle a (between the
+ * direction of travel and the edge normal) and speed v. With the sensors w
+ * apart sideways and l apart lengthwise:
+ *
+ * - Front and back sensor on the same side cross l / v apart
+ * - Left and right sensor on the same end cross w * tan(a) / v apart
+ *
+ * So tan(a) = (dt_left_right / dt_front_back) * (l / w), which doesn't depend
+ * on the speed. If only one end of the robot has crossed yet, the speed hint
+ * from the caller (e.g. the commanded speed) is used instead of dt_front_back.
+ *
+ * Timestamps are in ADC sequences (ADC_SEQUENCE_PERIOD_US), everything is
+ * fixed point.
+ */
+
+// Distance between the sensors, from the PCB layout
+#define LINE_SENSOR_WIDTH_MM (70L)
+#define LINE_SENSOR_LENGTH_MM (80L)
+
+#define ANGLE_90_DEG (900) // deci-degrees
+#define Q8_ONE (256L)
+
+/**
+ * atan of a Q8 value in [0, 1] in deci-degrees
+ * atan(x) ~= 45x + 15.6x(1 - x) degrees (max error ~0.3 degrees)
+ */
+static int16_t atan_q8_unit(int32_t x) {
+    return (int16_t)((x * (450L + (156L * (Q8_ONE - x)) / Q8_ONE)) / Q8_ONE);
+}
+
+/**
+ * atan of a non-negative Q8 value in deci-degrees
+ */
+static int16_t atan_q8(int32_t x) {
+    if (x <= Q8_ONE) {
+        return atan_q8_unit(x);
+    }
+    // atan(x) = 90 - atan(1 / x)
+    return ANGLE_90_DEG - atan_q8_unit((Q8_ONE * Q8_ONE) / x);
+}
+
+/**
+ * Time between two sensors crossing the line (b - a)
+ * @return false if either sensor hasn't crossed the line
+ */
+static bool line_geometry_get_dt(e__qre1113_pos a, e__qre1113_pos b,
+                                 int32_t *dt) {
+    uint32_t onset_a, onset_b;
+    if (!line_get_sensor_onset(a, &onset_a) ||
+        !line_get_sensor_onset(b, &onset_b)) {
+        return false;
+    }
+    *dt = (int32_t)(onset_b - onset_a);
+    return true;
+}
+
+/**
+ * Estimate the crossing angle and approach speed of the line currently seen
+ *
+ * @param speed_hint speed in mm/s used when only the front or the back sensors
+ * have crossed the line (0 if unknown)
+ * @param crossing the estimate
+ * @return false if there isn't enough information for an estimate
+ */
+bool line_geometry_get_crossing(uint16_t speed_hint,
+                                struct line_crossing *crossing) {
+    int32_t dt_left_right, dt_front_back;
+    // dt > 0 when the left sensor crossed first
+    if (!line_geometry_get_dt(QRE1113_POS_FRONT_LEFT, QRE1113_POS_FRONT_RIGHT,
+                              &dt_left_right) &&
+        !line_geometry_get_dt(QRE1113_POS_BACK_LEFT, QRE1113_POS_BACK_RIGHT,
+                              &dt_left_right)) {
+        return false;
+    }
+    const bool front_back_valid =
+        line_geometry_get_dt(QRE1113_POS_FRONT_LEFT, QRE1113_POS_BACK_LEFT,
+                             &dt_front_back) ||
+        line_geometry_get_dt(QRE1113_POS_FRONT_RIGHT, QRE1113_POS_BACK_RIGHT,
+                             &dt_front_back);
+
+    // Numerator and denominator of tan(a), both in mm * sequences
+    int32_t num = labs(dt_left_right) * LINE_SENSOR_LENGTH_MM;
+    int32_t den;
+    if (front_back_valid && dt_front_back != 0) {
+        den = labs(dt_front_back) * LINE_SENSOR_WIDTH_MM;
+        const int32_t speed =
+            (LINE_SENSOR_LENGTH_MM * 1000000L) /
+            (labs(dt_front_back) * (int32_t)ADC_SEQUENCE_PERIOD_US);
+        crossing->speed = speed > UINT16_MAX ? UINT16_MAX : (uint16_t)speed;
+    } else if (speed_hint) {
+        // tan(a) = dt_left_right * v / w, with v in mm per sequence
+        num = labs(dt_left_right) * speed_hint;
+        den = (LINE_SENSOR_WIDTH_MM * 1000000L) / ADC_SEQUENCE_PERIOD_US;
+        crossing->speed = 0;
+    } else {
+        return false;
+    }
+
+    // Keep the Q8 conversion within 32 bits
+    while (num > (INT32_MAX / Q8_ONE)) {
+        num >>= 1;
+        den >>= 1;
+    }
+    const int16_t angle = den ? atan_q8((num * Q8_ONE) / den) : ANGLE_90_DEG;
+    crossing->angle = dt_left_right >= 0 ? angle : -angle;
+    return true;
+}
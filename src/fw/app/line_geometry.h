@@ -0,0 +1,14 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Estimates how the robot crossed the edge of the dohyo from the time at which
+ * each qre1113 sensor started seeing the line. */
+
+struct line_crossing {
+    int16_t angle;  // Angle between the direction of travel and the edge normal
+                    // in deci-degrees, > 0 when the left sensors crossed first
+    uint16_t speed; // Approach speed in mm/s (0 if it couldn't be measured)
+};
+
+bool line_geometry_get_crossing(uint16_t speed_hint,
+                                struct line_crossing *crossing);
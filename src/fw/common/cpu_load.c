@@ -0,0 +1,138 @@
+#include "common/cpu_load.h"
+#include "common/assert_handler.h"
+#include "common/defines.h"
+#include "common/event.h"
+#include "common/prof.h"
+#include "common/trace.h"
+#include "drivers/systick.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * cpu_load_update() closes a slot of (nominally) CPU_LOAD_SLOT_MS with the
+ * time that passed and how much of it was idle. The last 10 slots make up the
+ * 100 ms window, and every 10 slots are also added up into a 100 ms slot, of
+ * which the last 10 make up the 1 s window. The actual time of every slot is
+ * kept, so a late update doesn't skew the load.
+ */
+#define CPU_LOAD_SLOT_CNT (10U)
+#define CPU_LOAD_CYCLES_PER_US (SMCLK / CYCLES_1MHZ)
+
+// Load with only the ISRs and events running, above it the self-check fails
+#define CPU_LOAD_SELF_CHECK_MAX (300U)
+
+struct cpu_load_slot {
+    uint32_t elapsed_us;
+    uint32_t idle_us;
+};
+
+static bool initialized = false;
+static uint32_t idle_us = 0; // Since init, wraps
+static uint32_t idle_start_us = 0;
+static uint32_t idle_start_isr_cycles = 0;
+static uint32_t update_us = 0;
+static uint32_t update_idle_us = 0;
+static struct cpu_load_slot short_slots[CPU_LOAD_SLOT_CNT];
+static struct cpu_load_slot long_slots[CPU_LOAD_SLOT_CNT];
+static struct cpu_load_slot long_slot_sum;
+static uint8_t short_idx = 0;
+static uint8_t long_idx = 0;
+
+void cpu_load_init(void) {
+    ASSERT(!initialized);
+    update_us = systick_micros();
+    update_idle_us = idle_us;
+    initialized = true;
+}
+
+/**
+ * Called by the main loop right before and after it sleeps
+ */
+void cpu_load_idle_begin(void) {
+    idle_start_isr_cycles = prof_get_isr_busy_cycles();
+    idle_start_us = systick_micros();
+}
+
+void cpu_load_idle_end(void) {
+    const uint32_t slept_us = systick_micros() - idle_start_us;
+    const uint32_t isr_us = (prof_get_isr_busy_cycles() -
+                             idle_start_isr_cycles) /
+                            CPU_LOAD_CYCLES_PER_US;
+    if (isr_us < slept_us) {
+        idle_us += slept_us - isr_us;
+    }
+}
+
+static void cpu_load_add(struct cpu_load_slot *sum,
+                         const struct cpu_load_slot *slot) {
+    sum->elapsed_us += slot->elapsed_us;
+    sum->idle_us += slot->idle_us;
+}
+
+/**
+ * Close the current slot, call every CPU_LOAD_SLOT_MS from the main loop
+ * (not while it's idle)
+ */
+void cpu_load_update(void) {
+    ASSERT(initialized);
+    const uint32_t now_us = systick_micros();
+    struct cpu_load_slot *slot = &short_slots[short_idx];
+    slot->elapsed_us = now_us - update_us;
+    slot->idle_us = idle_us - update_idle_us;
+    update_us = now_us;
+    update_idle_us = idle_us;
+
+    cpu_load_add(&long_slot_sum, slot);
+    short_idx = (short_idx + 1) % CPU_LOAD_SLOT_CNT;
+    if (short_idx == 0) {
+        long_slots[long_idx] = long_slot_sum;
+        long_idx = (long_idx + 1) % CPU_LOAD_SLOT_CNT;
+        long_slot_sum.elapsed_us = 0;
+        long_slot_sum.idle_us = 0;
+    }
+}
+
+/**
+ * Load in permille over the window, 0 until the first slot is closed
+ */
+uint16_t cpu_load_get(cpu_load_window_enum window) {
+    ASSERT((window < CPU_LOAD_WINDOW_CNT));
+    const struct cpu_load_slot *slots =
+        window == CPU_LOAD_WINDOW_100MS ? short_slots : long_slots;
+    struct cpu_load_slot sum = {0, 0};
+    for (uint8_t i = 0; i < CPU_LOAD_SLOT_CNT; i++) {
+        cpu_load_add(&sum, &slots[i]);
+    }
+    if (!sum.elapsed_us) {
+        return 0;
+    }
+    // Scale down so the permille fits in 32 bits (1 s is ~2^20 us)
+    while (sum.elapsed_us > (UINT32_MAX / 1000U)) {
+        sum.elapsed_us >>= 1;
+        sum.idle_us >>= 1;
+    }
+    const uint32_t idle_permille = (sum.idle_us * 1000U) / sum.elapsed_us;
+    return idle_permille < 1000U ? (uint16_t)(1000U - idle_permille) : 0;
+}
+
+/**
+ * Measure the load of the ISRs and event handlers alone over 100 ms, before
+ * the tasks are started. Fails if it's so high there is little left for the
+ * tasks (which is also the case if the idle time isn't accounted).
+ */
+bool cpu_load_self_check(void) {
+    ASSERT(initialized);
+    uint32_t wake_ms = systick_millis();
+    cpu_load_update(); // Start from a fresh slot
+    for (uint8_t i = 0; i < CPU_LOAD_SLOT_CNT; i++) {
+        wake_ms += CPU_LOAD_SLOT_MS;
+        while (systick_is_after(wake_ms, systick_millis())) {
+            event_dispatch();
+            event_sleep_until(wake_ms);
+        }
+        cpu_load_update();
+    }
+    const uint16_t load = cpu_load_get(CPU_LOAD_WINDOW_100MS);
+    TRACE("CPU load without tasks %u/1000", load);
+    return load <= CPU_LOAD_SELF_CHECK_MAX;
+}
@@ -0,0 +1,27 @@
+#ifndef CPU_LOAD_H
+#define CPU_LOAD_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* CPU load from the time the main loop idles in LPM0, less the time spent in
+ * the ISRs serviced while it's idle. Only ISRs defined with
+ * PROF_INTERRUPT_FUNCTION are subtracted, so define every ISR with it (with
+ * DISABLE_PROF that time counts as idle). The load is in permille, averaged
+ * over a rolling window that moves every CPU_LOAD_SLOT_MS. */
+
+#define CPU_LOAD_SLOT_MS (10U)
+
+typedef enum {
+    CPU_LOAD_WINDOW_100MS, // 10 slots
+    CPU_LOAD_WINDOW_1S,    // 10 slots of 100 ms
+    CPU_LOAD_WINDOW_CNT
+} cpu_load_window_enum;
+
+void cpu_load_init(void);
+void cpu_load_idle_begin(void);
+void cpu_load_idle_end(void);
+void cpu_load_update(void);
+uint16_t cpu_load_get(cpu_load_window_enum window);
+bool cpu_load_self_check(void);
+
+#endif // CPU_LOAD_H
@@ -8,7 +8,17 @@
 #define CYCLES_16MHZ (16U * CYCLES_1MHZ)
 #define CYCLES_PER_MS (CYCLES_16MHZ / 1000U)
 #define ms_TO_CYCLES(ms) (CYCLES_PER_MS * ms)
+// Only for where the system tick can't be relied on (e.g. the assert handler),
+// use systick_sleep_ms() everywhere else
 #define BUSY_WAIT_ms(ms) __delay_cycles(ms_TO_CYCLES(ms));
 
+// Disable interrupts and restore the previous state afterwards, so it can be
+// used from both ISR and main context. Requires msp430.h.
+#define CRITICAL_SECTION_BEGIN()                                               \
+    const uint16_t critical_section_sr = __get_SR_register();                  \
+    __disable_interrupt()
+#define CRITICAL_SECTION_END() __bis_SR_register(critical_section_sr & GIE)
+
 #define SMCLK (CYCLES_16MHZ)
+#define TIMER_INPUT_DIVIER_0 (1U)
 #define TIMER_INPUT_DIVIER_3 (8U)
@@ -0,0 +1,134 @@
+#include "common/event.h"
+#include "common/assert_handler.h"
+#include "common/cpu_load.h"
+#include "drivers/systick.h"
+#include <assert.h>
+#include <msp430.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The queue is a ring buffer without locks. ISRs are the producers and only
+ * move the head, the main loop is the only consumer and only moves the tail.
+ * ISRs don't nest, so producers never interrupt each other, which means
+ * events must only be posted from ISRs (or with interrupts disabled).
+ */
+static_assert((EVENT_QUEUE_SIZE & (EVENT_QUEUE_SIZE - 1)) == 0,
+              "Queue size must be a power of 2");
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+
+static bool initialized = false;
+static volatile struct event queue[EVENT_QUEUE_SIZE];
+static volatile uint8_t head = 0; // Next slot to post to
+static volatile uint8_t tail = 0; // Next event to dispatch
+static event_handler handlers[EVENT_CNT];
+static struct event_stats stats[EVENT_CNT];
+static volatile uint16_t dropped_cnts[EVENT_CNT]; // Written by the producers
+static uint32_t reset_us = 0;
+static uint32_t asleep_us = 0;
+
+void event_init(void) {
+    ASSERT(!initialized);
+    event_reset_stats();
+    initialized = true;
+}
+
+void event_register_handler(event_type_enum type, event_handler handler) {
+    ASSERT((type < EVENT_CNT));
+    handlers[type] = handler;
+}
+
+/**
+ * Queue an event, it's dropped (and counted) if the queue is full, in which
+ * case false is returned. Only from ISRs, which should then use
+ * EVENT_WAKE_ON_EXIT_IF_PENDING().
+ */
+bool event_post(event_type_enum type, uint8_t data) {
+    ASSERT((type < EVENT_CNT));
+    const uint8_t next_head = (head + 1) & EVENT_QUEUE_MASK;
+    if (next_head == tail) {
+        dropped_cnts[type]++;
+        return false;
+    }
+    volatile struct event *event = &queue[head];
+    event->type = type;
+    event->data = data;
+    event->posted_us = (uint16_t)systick_micros();
+    // Publish the event only once it's complete
+    head = next_head;
+    return true;
+}
+
+bool event_is_pending(void) { return head != tail; }
+
+/**
+ * Dispatch all queued events to their handlers, returns false if there were
+ * none
+ */
+bool event_dispatch(void) {
+    ASSERT(initialized);
+    bool dispatched = false;
+    while (tail != head) {
+        const struct event event = queue[tail];
+        tail = (tail + 1) & EVENT_QUEUE_MASK;
+        const uint16_t latency_us =
+            (uint16_t)systick_micros() - event.posted_us;
+        struct event_stats *type_stats = &stats[event.type];
+        type_stats->dispatch_cnt++;
+        type_stats->total_latency_us += latency_us;
+        if (latency_us > type_stats->max_latency_us) {
+            type_stats->max_latency_us = latency_us;
+        }
+        if (handlers[event.type]) {
+            handlers[event.type](&event);
+        }
+        dispatched = true;
+    }
+    return dispatched;
+}
+
+/**
+ * Idle in LPM0 until the ms counter reaches wake_ms or an event is posted.
+ * LPM3 would stop SMCLK, which clocks the PWM, the ADC and the system tick, so
+ * the CPU is only ever put in LPM0.
+ */
+void event_sleep_until(uint32_t wake_ms) {
+    ASSERT(initialized);
+    ASSERT((__get_SR_register() & GIE));
+    const uint32_t start_us = systick_micros();
+    cpu_load_idle_begin();
+    // Interrupts are disabled between the checks and entering LPM0 (which
+    // enables them again), so a wake up can't slip in between and be missed
+    __disable_interrupt();
+    while (head == tail && systick_is_after(wake_ms, systick_millis())) {
+        __bis_SR_register(LPM0_bits | GIE);
+        __disable_interrupt();
+    }
+    __enable_interrupt();
+    cpu_load_idle_end();
+    asleep_us += systick_micros() - start_us;
+}
+
+void event_get_stats(event_type_enum type, struct event_stats *type_stats) {
+    ASSERT((type < EVENT_CNT));
+    *type_stats = stats[type];
+    type_stats->dropped_cnt = dropped_cnts[type];
+}
+
+void event_get_power_stats(struct event_power_stats *power_stats) {
+    power_stats->elapsed_us = systick_micros() - reset_us;
+    power_stats->asleep_us = asleep_us;
+}
+
+void event_reset_stats(void) {
+    for (uint8_t i = 0; i < EVENT_CNT; i++) {
+        stats[i].dispatch_cnt = 0;
+        stats[i].total_latency_us = 0;
+        stats[i].max_latency_us = 0;
+        stats[i].dropped_cnt = 0;
+        dropped_cnts[i] = 0;
+    }
+    reset_us = systick_micros();
+    asleep_us = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef EVENT_H
+#define EVENT_H
+#include <msp430.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Queue of events posted by ISRs and dispatched to their handlers by the main
+ * loop, which sleeps in LPM0 while there is nothing to do. */
+
+typedef enum {
+    EVENT_LINE,        // data: e__line, the line classification changed
+    EVENT_RANGE_READY, // data: unused, a range measurement is ready to read
+    EVENT_TIMER,       // data: unused, deferred timer wheel callbacks are due
+    EVENT_CNT
+} event_type_enum;
+
+#define EVENT_QUEUE_SIZE (16U) // Must be a power of 2
+
+struct event {
+    event_type_enum type;
+    uint8_t data;
+    uint16_t posted_us; // Lower 16 bits of systick_micros()
+};
+
+typedef void (*event_handler)(const struct event *event);
+
+struct event_stats {
+    uint32_t dispatch_cnt;
+    uint32_t total_latency_us; // From post to dispatch
+    uint16_t max_latency_us;
+    uint16_t dropped_cnt; // Posted while the queue was full
+};
+
+struct event_power_stats {
+    uint32_t elapsed_us; // Since the stats were reset
+    uint32_t asleep_us;  // Of which in LPM0 (including ISRs serviced there)
+};
+
+/* Wake up the main loop when the ISR it's used in has posted an event, must
+ * be used in the ISR function itself (not in a function it calls), or in the
+ * body of a PROF_INTERRUPT_FUNCTION, which is inlined into it */
+#define EVENT_WAKE_ON_EXIT_IF_PENDING()                                        \
+    do {                                                                       \
+        if (event_is_pending()) {                                              \
+            __bic_SR_register_on_exit(LPM0_bits);                              \
+        }                                                                      \
+    } while (0)
+
+void event_init(void);
+void event_register_handler(event_type_enum type, event_handler handler);
+bool event_post(event_type_enum type, uint8_t data);
+bool event_is_pending(void);
+bool event_dispatch(void);
+void event_sleep_until(uint32_t wake_ms);
+void event_get_stats(event_type_enum type, struct event_stats *type_stats);
+void event_get_power_stats(struct event_power_stats *power_stats);
+void event_reset_stats(void);
+
+#endif // EVENT_H
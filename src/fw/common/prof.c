@@ -0,0 +1,256 @@
+#ifndef DISABLE_PROF
+#include "common/prof.h"
+#include "common/assert_handler.h"
+#include "common/defines.h"
+#include "common/trace.h"
+#include <msp430.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * TB0 counts SMCLK cycles in continuous mode and wraps every 4.096 ms, the
+ * overflow ISR extends it to 32 bits (~268 s), so sections longer than a wrap
+ * are measured correctly too.
+ */
+
+static bool initialized = false;
+static volatile uint16_t overflow_cnt = 0;
+static uint32_t overhead_cycles = 0;
+static struct prof_stats stats[PROF_CNT];
+static struct prof_isr_hist isr_hists[PROF_ISR_CNT];
+static volatile uint32_t isr_busy_cycles = 0; // Of all ISRs, never reset
+static uint32_t reset_cycles = 0;
+
+static const char *const prof_names[PROF_CNT] = {
+    [PROF_LINE_CLASSIFY] = "line classify",
+    [PROF_RANGE_READ] = "range read",
+    [PROF_ISR_DMA] = "isr dma",
+    [PROF_IO_ISR] = "io isr",
+};
+
+static const char *const prof_isr_names[PROF_ISR_CNT] = {
+    [PROF_ISR_PORT_1] = "isr_port_1",
+    [PROF_ISR_PORT_2] = "isr_port_2",
+    [PROF_ISR_ADC_DMA] = "isr_dma",
+    [PROF_ISR_UART_TX] = "uart_tx_isr",
+    [PROF_ISR_SYSTICK] = "isr_systick",
+    [PROF_ISR_PWM_PERIOD] = "isr_pwm_period",
+    [PROF_ISR_PWM_COMPARE_TA0] = "isr_pwm_compare_ta0",
+    [PROF_ISR_PWM_COMPARE_TA2] = "isr_pwm_compare_ta2",
+    [PROF_ISR_PROF_OVERFLOW] = "isr_prof_overflow",
+};
+
+void prof_init(void) {
+    ASSERT(!initialized);
+    TB0CTL = TBSSEL_2 | ID_0 | MC_0 | TBCLR;
+    TB0CTL |= TBIE | MC_2;
+    initialized = true;
+    prof_reset();
+    // Time of an empty section, subtracted from every measurement
+    const uint32_t start = prof_cycles();
+    overhead_cycles = prof_cycles() - start;
+}
+
+uint32_t prof_cycles(void) {
+    uint16_t high;
+    uint16_t count;
+    CRITICAL_SECTION_BEGIN();
+    high = overflow_cnt;
+    count = TB0R;
+    // Same as systick_micros(), the overflow may still be pending
+    if ((TB0CTL & TBIFG) && count < 0x8000U) {
+        high++;
+    }
+    CRITICAL_SECTION_END();
+    return ((uint32_t)high << 16) | count;
+}
+
+/**
+ * Add a section that started at start_cycles (prof_cycles()) and ends now
+ */
+void prof_record(prof_id_enum id, uint32_t start_cycles) {
+    ASSERT(initialized);
+    ASSERT((id < PROF_CNT));
+    uint32_t cycles = prof_cycles() - start_cycles;
+    cycles = cycles > overhead_cycles ? cycles - overhead_cycles : 0;
+    CRITICAL_SECTION_BEGIN();
+    struct prof_stats *id_stats = &stats[id];
+    id_stats->cnt++;
+    id_stats->total_cycles += cycles;
+    if (cycles < id_stats->min_cycles) {
+        id_stats->min_cycles = cycles;
+    }
+    if (cycles > id_stats->max_cycles) {
+        id_stats->max_cycles = cycles;
+    }
+    CRITICAL_SECTION_END();
+}
+
+void prof_get_stats(prof_id_enum id, struct prof_stats *id_stats) {
+    ASSERT((id < PROF_CNT));
+    CRITICAL_SECTION_BEGIN();
+    *id_stats = stats[id];
+    CRITICAL_SECTION_END();
+}
+
+/**
+ * Bucket of the histogram, the number of significant bits
+ */
+static uint8_t prof_hist_bucket(uint32_t cycles) {
+    uint8_t bucket = 0;
+    while (cycles && bucket < PROF_HIST_BUCKET_CNT - 1) {
+        cycles >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void prof_hist_add(uint16_t *hist, uint32_t cycles) {
+    uint16_t *cnt = &hist[prof_hist_bucket(cycles)];
+    if (*cnt < UINT16_MAX) {
+        (*cnt)++;
+    }
+}
+
+/**
+ * Called at the end of an ISR defined with PROF_INTERRUPT_FUNCTION, with
+ * interrupts still disabled
+ */
+void prof_isr_record(prof_isr_enum isr, uint32_t entry_cycles,
+                     uint32_t latency_cycles) {
+    ASSERT((isr < PROF_ISR_CNT));
+    uint32_t cycles = prof_cycles() - entry_cycles;
+    cycles = cycles > overhead_cycles ? cycles - overhead_cycles : 0;
+    struct prof_isr_hist *isr_hist = &isr_hists[isr];
+    prof_hist_add(isr_hist->duration, cycles);
+    isr_hist->busy_cycles += cycles;
+    isr_busy_cycles += cycles;
+    if (cycles > isr_hist->max_duration_cycles) {
+        isr_hist->max_duration_cycles = cycles;
+    }
+    if (latency_cycles != PROF_LATENCY_UNKNOWN) {
+        prof_hist_add(isr_hist->latency, latency_cycles);
+        if (latency_cycles > isr_hist->max_latency_cycles) {
+            isr_hist->max_latency_cycles = latency_cycles;
+        }
+    }
+}
+
+void prof_get_isr_hist(prof_isr_enum isr, struct prof_isr_hist *isr_hist) {
+    ASSERT((isr < PROF_ISR_CNT));
+    CRITICAL_SECTION_BEGIN();
+    *isr_hist = isr_hists[isr];
+    CRITICAL_SECTION_END();
+}
+
+/**
+ * Time spent in the ISRs defined with PROF_INTERRUPT_FUNCTION since init,
+ * wraps after ~268 s so only use the difference between two calls
+ */
+uint32_t prof_get_isr_busy_cycles(void) {
+    uint32_t busy_cycles;
+    CRITICAL_SECTION_BEGIN();
+    busy_cycles = isr_busy_cycles;
+    CRITICAL_SECTION_END();
+    return busy_cycles;
+}
+
+/**
+ * Trace the non-empty buckets as <lowest cycles>:<count>
+ */
+static void prof_trace_hist(const char *name, const uint16_t *hist) {
+    trace("%s", name);
+    for (uint8_t bucket = 0; bucket < PROF_HIST_BUCKET_CNT; bucket++) {
+        if (hist[bucket]) {
+            const uint16_t lowest = bucket ? 1U << (bucket - 1) : 0;
+            trace(" %u:%u", lowest, hist[bucket]);
+        }
+    }
+    trace("\n");
+}
+
+/**
+ * Trace one line of the stats measured since the last reset, the stats of a
+ * section for line < PROF_CNT and the summary of an ISR after that. Nothing is
+ * traced for a section or ISR that hasn't run. Lets the stats be traced a
+ * line at a time, without the histograms.
+ */
+void prof_trace_line(uint8_t line) {
+    ASSERT(initialized);
+    ASSERT((line < PROF_TRACE_LINE_CNT));
+    if (line < PROF_CNT) {
+        struct prof_stats id_stats;
+        prof_get_stats(line, &id_stats);
+        if (id_stats.cnt) {
+            TRACE("%s n %lu min %lu avg %lu max %lu cycles", prof_names[line],
+                  id_stats.cnt, id_stats.min_cycles,
+                  id_stats.total_cycles / id_stats.cnt, id_stats.max_cycles);
+        }
+        return;
+    }
+    const prof_isr_enum isr = line - PROF_CNT;
+    struct prof_isr_hist isr_hist;
+    prof_get_isr_hist(isr, &isr_hist);
+    if (!isr_hist.max_duration_cycles) {
+        return;
+    }
+    const uint32_t elapsed_kcycles = (prof_cycles() - reset_cycles) / 1000U;
+    const uint32_t busy_permille =
+        elapsed_kcycles ? isr_hist.busy_cycles / elapsed_kcycles : 0;
+    TRACE("%s busy %lu/1000 max duration %lu latency %lu cycles",
+          prof_isr_names[isr], busy_permille, isr_hist.max_duration_cycles,
+          isr_hist.max_latency_cycles);
+}
+
+/**
+ * Trace the stats of every section measured since the last reset, the total
+ * overflows after ~268 s of measured time so reset them regularly
+ */
+void prof_dump(void) {
+    ASSERT(initialized);
+    for (prof_id_enum id = 0; id < PROF_CNT; id++) {
+        prof_trace_line(id);
+    }
+    for (prof_isr_enum isr = 0; isr < PROF_ISR_CNT; isr++) {
+        struct prof_isr_hist isr_hist;
+        prof_get_isr_hist(isr, &isr_hist);
+        if (!isr_hist.max_duration_cycles) {
+            continue;
+        }
+        prof_trace_line(PROF_CNT + isr);
+        prof_trace_hist("  duration", isr_hist.duration);
+        if (isr_hist.max_latency_cycles) {
+            prof_trace_hist("  latency", isr_hist.latency);
+        }
+    }
+}
+
+void prof_reset(void) {
+    CRITICAL_SECTION_BEGIN();
+    for (prof_id_enum id = 0; id < PROF_CNT; id++) {
+        stats[id].cnt = 0;
+        stats[id].total_cycles = 0;
+        stats[id].min_cycles = UINT32_MAX;
+        stats[id].max_cycles = 0;
+    }
+    for (prof_isr_enum isr = 0; isr < PROF_ISR_CNT; isr++) {
+        isr_hists[isr] = (struct prof_isr_hist){0};
+    }
+    reset_cycles = prof_cycles();
+    CRITICAL_SECTION_END();
+}
+
+// TB0 overflows to 0, so its count is the time since. The overflow is still
+// pending when the entry time is taken and counted by the time the ISR ends,
+// prof_cycles() is correct at both.
+PROF_INTERRUPT_FUNCTION(TIMER0_B1_VECTOR, isr_prof_overflow,
+                        PROF_ISR_PROF_OVERFLOW, TB0R) {
+    switch (__even_in_range(TB0IV, TB0IV_TBIFG)) {
+    case TB0IV_TBIFG:
+        overflow_cnt++;
+        break;
+    default:
+        break;
+    }
+}
+#endif
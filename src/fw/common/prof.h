@@ -0,0 +1,97 @@
+#ifndef PROF_H
+#define PROF_H
+#include "common/defines.h"
+#include <stdint.h>
+
+/* Execution time of hot code sections in SMCLK cycles, measured with the
+ * free-running timer TB0. Wrap a section in PROF_BEGIN(id) and PROF_END(id)
+ * (in the same block), the time includes any ISR that preempts it. Build with
+ * -DDISABLE_PROF to compile all of it out. */
+
+typedef enum {
+    PROF_LINE_CLASSIFY, // Line classification of an ADC sequence
+    PROF_RANGE_READ,    // vl53l0x_read_range_multiple()
+    PROF_ISR_DMA,       // ADC DMA ISR, includes PROF_LINE_CLASSIFY
+    PROF_IO_ISR,        // IO interrupt of a pin with its flag set
+    PROF_CNT
+} prof_id_enum;
+
+struct prof_stats {
+    uint32_t cnt;
+    uint32_t total_cycles;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+};
+
+/* ISRs defined with PROF_INTERRUPT_FUNCTION, which keeps a histogram of how
+ * long they take and, where the trigger time can be read back (e.g. a timer
+ * count), how long after it they were entered */
+typedef enum {
+    PROF_ISR_PORT_1,
+    PROF_ISR_PORT_2,
+    PROF_ISR_ADC_DMA,
+    PROF_ISR_UART_TX,
+    PROF_ISR_SYSTICK,
+    PROF_ISR_PWM_PERIOD,
+    PROF_ISR_PWM_COMPARE_TA0,
+    PROF_ISR_PWM_COMPARE_TA2,
+    PROF_ISR_PROF_OVERFLOW,
+    PROF_ISR_CNT
+} prof_isr_enum;
+
+/* Bucket 0 counts 0 cycles and bucket b 2^(b-1) to 2^b - 1 cycles, the last
+ * bucket also counts everything longer. The counts saturate. */
+#define PROF_HIST_BUCKET_CNT (16U)
+#define PROF_LATENCY_UNKNOWN (UINT32_MAX)
+
+struct prof_isr_hist {
+    uint16_t duration[PROF_HIST_BUCKET_CNT];
+    uint16_t latency[PROF_HIST_BUCKET_CNT]; // Empty if the latency is unknown
+    uint32_t max_duration_cycles;
+    uint32_t max_latency_cycles;
+    uint32_t busy_cycles; // Total duration
+};
+
+#ifndef DISABLE_PROF
+#define PROF_BEGIN(id) const uint32_t prof_start_##id = prof_cycles()
+#define PROF_END(id) prof_record(id, prof_start_##id)
+
+/* Use instead of INTERRUPT_FUNCTION(vector) name(void), the body becomes a
+ * function inlined into the ISR, so it may use __bic_SR_register_on_exit().
+ * latency_cycles is evaluated first thing in the ISR. */
+#define PROF_INTERRUPT_FUNCTION(vector, name, isr, latency_cycles)             \
+    static inline __attribute__((always_inline)) void name##_body(void);       \
+    INTERRUPT_FUNCTION(vector) name(void) {                                    \
+        const uint32_t prof_isr_latency = (latency_cycles);                    \
+        const uint32_t prof_isr_entry = prof_cycles();                         \
+        name##_body();                                                         \
+        prof_isr_record(isr, prof_isr_entry, prof_isr_latency);                \
+    }                                                                          \
+    static inline __attribute__((always_inline)) void name##_body(void)
+
+void prof_init(void);
+uint32_t prof_cycles(void);
+void prof_record(prof_id_enum id, uint32_t start_cycles);
+void prof_get_stats(prof_id_enum id, struct prof_stats *id_stats);
+void prof_isr_record(prof_isr_enum isr, uint32_t entry_cycles,
+                     uint32_t latency_cycles);
+void prof_get_isr_hist(prof_isr_enum isr, struct prof_isr_hist *isr_hist);
+uint32_t prof_get_isr_busy_cycles(void);
+#define PROF_TRACE_LINE_CNT (PROF_CNT + PROF_ISR_CNT)
+void prof_trace_line(uint8_t line);
+void prof_dump(void);
+void prof_reset(void);
+#else
+#define PROF_BEGIN(id)
+#define PROF_END(id)
+#define PROF_INTERRUPT_FUNCTION(vector, name, isr, latency_cycles)             \
+    INTERRUPT_FUNCTION(vector) name(void)
+#define prof_init() ;
+#define prof_get_isr_busy_cycles() (0UL)
+#define PROF_TRACE_LINE_CNT (0U)
+#define prof_trace_line(line) ((void)(line))
+#define prof_dump() ;
+#define prof_reset() ;
+#endif
+
+#endif // PROF_H
@@ -0,0 +1,120 @@
+#ifndef PT_H
+#define PT_H
+#include "drivers/systick.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Protothreads, stackless coroutines for long sequences (e.g. a countdown or
+ * a bring-up with waits) that are written linearly but return to the caller
+ * at every wait, so several of them run interleaved from the main loop
+ * without each needing a hand-written state machine.
+ *
+ * A protothread is a function declared with PT_THREAD that is called over
+ * and over (e.g. from a scheduler task) with its struct pt, and continues
+ * from where it last waited. The struct pt is all the state there is (6
+ * bytes), it remembers where to continue with the GCC labels as values
+ * extension. The function's stack is gone between calls, so:
+ * - Locals don't keep their value across a wait, make them static
+ * - There can't be two PT_ macros on the same line (labels come from
+ *   __LINE__)
+ *
+ * Example:
+ *     static PT_THREAD(blink(struct pt *pt)) {
+ *         PT_BEGIN(pt);
+ *         while (1) {
+ *             led_toggle();
+ *             PT_WAIT_MS(pt, 500);
+ *         }
+ *         PT_END(pt);
+ *     }
+ */
+
+struct pt {
+    void *lc;               // Where to continue, NULL to start over
+    uint32_t wait_start_ms; // Start of PT_WAIT_MS
+};
+
+typedef enum {
+    PT_WAITING, // Waiting for a condition
+    PT_YIELDED, // Gave up the CPU for one call
+    PT_EXITED,  // Left with PT_EXIT, starts over on the next call
+    PT_ENDED    // Reached PT_END, starts over on the next call
+} pt_state_enum;
+
+#define PT_THREAD(name_args) pt_state_enum name_args
+
+#define PT_CONCAT2(a, b) a##b
+#define PT_CONCAT(a, b) PT_CONCAT2(a, b)
+#define PT_SET(pt)                                                             \
+    do {                                                                       \
+        PT_CONCAT(pt_label_, __LINE__)                                         \
+            : (pt)->lc = &&PT_CONCAT(pt_label_, __LINE__);                     \
+    } while (0)
+
+#define PT_INIT(pt) ((pt)->lc = NULL)
+
+#define PT_BEGIN(pt)                                                           \
+    {                                                                          \
+        uint8_t pt_yield_flag = 1;                                             \
+        (void)pt_yield_flag;                                                   \
+        if ((pt)->lc) {                                                        \
+            goto *(pt)->lc;                                                    \
+        }
+
+#define PT_END(pt)                                                             \
+    PT_INIT(pt);                                                               \
+    return PT_ENDED;                                                           \
+    }
+
+#define PT_WAIT_UNTIL(pt, condition)                                           \
+    do {                                                                       \
+        PT_SET(pt);                                                            \
+        if (!(condition)) {                                                    \
+            return PT_WAITING;                                                 \
+        }                                                                      \
+    } while (0)
+
+#define PT_WAIT_WHILE(pt, condition) PT_WAIT_UNTIL(pt, !(condition))
+
+// Wait at least ms, checked each time the protothread is called
+#define PT_WAIT_MS(pt, ms)                                                     \
+    do {                                                                       \
+        (pt)->wait_start_ms = systick_millis();                                \
+        PT_WAIT_UNTIL(pt, systick_ms_since((pt)->wait_start_ms) >= (ms));      \
+    } while (0)
+
+// Run a child protothread until it exits or ends
+#define PT_WAIT_THREAD(pt, thread) PT_WAIT_WHILE(pt, (thread) < PT_EXITED)
+#define PT_SPAWN(pt, child, thread)                                            \
+    do {                                                                       \
+        PT_INIT(child);                                                        \
+        PT_WAIT_THREAD(pt, thread);                                            \
+    } while (0)
+
+// Give up the CPU until the next call
+#define PT_YIELD(pt)                                                           \
+    do {                                                                       \
+        pt_yield_flag = 0;                                                     \
+        PT_SET(pt);                                                            \
+        if (!pt_yield_flag) {                                                  \
+            return PT_YIELDED;                                                 \
+        }                                                                      \
+    } while (0)
+
+#define PT_RESTART(pt)                                                         \
+    do {                                                                       \
+        PT_INIT(pt);                                                           \
+        return PT_WAITING;                                                     \
+    } while (0)
+
+#define PT_EXIT(pt)                                                            \
+    do {                                                                       \
+        PT_INIT(pt);                                                           \
+        return PT_EXITED;                                                      \
+    } while (0)
+
+// True while the protothread hasn't exited or ended
+#define PT_SCHEDULE(thread) ((thread) < PT_EXITED)
+
+#endif // PT_H
@@ -0,0 +1,114 @@
+#include "common/scheduler.h"
+#include "common/assert_handler.h"
+#include "common/event.h"
+#include "drivers/systick.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Each task is released every period_ms on the system tick. Every time the
+ * CPU wakes up, the queued events are dispatched and the tasks whose release
+ * time has come run one after the other, then the CPU sleeps in LPM0 until the
+ * next release or event. Start jitter is
+ * the time from the release to the start of the task, which includes the
+ * tasks ahead of it in the table. A task that is still not done (or hasn't
+ * even started) by its next release overruns, and the releases it missed are
+ * skipped instead of run back to back.
+ */
+
+static bool initialized = false;
+static const struct scheduler_task *tasks = NULL;
+static uint8_t task_cnt = 0;
+static uint32_t releases_ms[SCHEDULER_TASK_MAX];
+static struct scheduler_task_stats stats[SCHEDULER_TASK_MAX];
+
+void scheduler_init(const struct scheduler_task *new_tasks,
+                    uint8_t new_task_cnt) {
+    ASSERT(!initialized);
+    ASSERT(new_tasks);
+    ASSERT((new_task_cnt > 0 && new_task_cnt <= SCHEDULER_TASK_MAX));
+    tasks = new_tasks;
+    task_cnt = new_task_cnt;
+    const uint32_t now_ms = systick_millis();
+    for (uint8_t i = 0; i < task_cnt; i++) {
+        ASSERT(tasks[i].fn);
+        ASSERT(tasks[i].period_ms > 0);
+        releases_ms[i] = now_ms + tasks[i].offset_ms;
+    }
+    scheduler_reset_stats();
+    initialized = true;
+}
+
+static inline uint16_t scheduler_saturate(uint32_t us) {
+    return us > UINT16_MAX ? UINT16_MAX : (uint16_t)us;
+}
+
+static void scheduler_run_task(uint8_t idx) {
+    const struct scheduler_task *task = &tasks[idx];
+    struct scheduler_task_stats *task_stats = &stats[idx];
+    // micros is ms * 1000 + count modulo 2^32, so this stays consistent
+    const uint32_t release_us = releases_ms[idx] * SYSTICK_US_PER_TICK;
+    const uint32_t start_us = systick_micros();
+    task->fn();
+    const uint32_t end_us = systick_micros();
+
+    const uint16_t jitter_us = scheduler_saturate(start_us - release_us);
+    const uint16_t execution_us = scheduler_saturate(end_us - start_us);
+    task_stats->run_cnt++;
+    if (jitter_us > task_stats->max_jitter_us) {
+        task_stats->max_jitter_us = jitter_us;
+    }
+    if (execution_us > task_stats->wcet_us) {
+        task_stats->wcet_us = execution_us;
+    }
+
+    releases_ms[idx] += task->period_ms;
+    const uint32_t now_ms = systick_millis();
+    while (!systick_is_after(releases_ms[idx], now_ms)) {
+        releases_ms[idx] += task->period_ms;
+        task_stats->overrun_cnt++;
+    }
+}
+
+/**
+ * Run the tasks forever
+ */
+void scheduler_run(void) {
+    ASSERT(initialized);
+    while (1) {
+        event_dispatch();
+        uint32_t now_ms = systick_millis();
+        for (uint8_t i = 0; i < task_cnt; i++) {
+            if (!systick_is_after(releases_ms[i], now_ms)) {
+                scheduler_run_task(i);
+            }
+        }
+        // Sleep until the earliest release, unless one is already due
+        now_ms = systick_millis();
+        uint32_t next_ms = releases_ms[0];
+        for (uint8_t i = 1; i < task_cnt; i++) {
+            if (systick_is_after(next_ms, releases_ms[i])) {
+                next_ms = releases_ms[i];
+            }
+        }
+        if (systick_is_after(next_ms, now_ms)) {
+            event_sleep_until(next_ms);
+        }
+    }
+}
+
+void scheduler_get_stats(uint8_t task_idx,
+                         struct scheduler_task_stats *task_stats) {
+    ASSERT((task_idx < task_cnt));
+    *task_stats = stats[task_idx];
+}
+
+void scheduler_reset_stats(void) {
+    for (uint8_t i = 0; i < SCHEDULER_TASK_MAX; i++) {
+        stats[i].run_cnt = 0;
+        stats[i].wcet_us = 0;
+        stats[i].max_jitter_us = 0;
+        stats[i].overrun_cnt = 0;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <stdint.h>
+
+/* Time-triggered scheduler for a static table of periodic tasks, paced by
+ * the system tick, which also dispatches the events (see event.h) in between.
+ * Tasks run to completion in table order, so put the ones with the tightest
+ * deadlines first. */
+
+#define SCHEDULER_TASK_MAX (8U)
+
+typedef void (*scheduler_task_fn)(void);
+
+struct scheduler_task {
+    const char *name;
+    scheduler_task_fn fn;
+    uint16_t period_ms;
+    uint16_t offset_ms; // First release, to spread out tasks of the same rate
+};
+
+struct scheduler_task_stats {
+    uint32_t run_cnt;
+    uint16_t wcet_us;       // Worst-case execution time
+    uint16_t max_jitter_us; // Worst delay between release and start
+    uint16_t overrun_cnt;   // Releases missed because the task ran late
+};
+
+void scheduler_init(const struct scheduler_task *tasks, uint8_t task_cnt);
+void scheduler_run(void);
+void scheduler_get_stats(uint8_t task_idx,
+                         struct scheduler_task_stats *task_stats);
+void scheduler_reset_stats(void);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,20 @@
+#ifndef STACK_H
+#define STACK_H
+#include <stdint.h>
+
+/* The stack grows down from the end of RAM towards the heap (malloc) above
+ * .data and .bss. The free RAM between them is painted at startup, and the
+ * paint the stack hasn't overwritten shows how deep it has ever been. The
+ * static worst case is checked at build time with "make stack". */
+
+#define STACK_PAINT (0xA5A5U)
+
+struct stack_usage {
+    uint16_t high_water; // Most the stack has used since startup, incl. ISRs
+    uint16_t free;       // Between the heap and the deepest the stack has been
+};
+
+void stack_paint(void);
+void stack_get_usage(struct stack_usage *usage);
+
+#endif // STACK_H
@@ -0,0 +1,191 @@
+#include "common/timer_wheel.h"
+#include "common/assert_handler.h"
+#include "common/defines.h"
+#include "common/event.h"
+#include "drivers/systick.h"
+#include <msp430.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Hierarchical timer wheel:
+ * Level 0 has a slot per ms of the current 32 ms block, level 1 a slot per
+ * block of the current 1024 ms, level 2 a slot per 1024 ms of the current
+ * 32768 ms, and timers further away than that wait in an overflow list. A
+ * timer goes into the lowest level whose span contains both now and its
+ * expiry. Each tick expires the level 0 slot of the current ms, and whenever
+ * the tick crosses into a new block (or span of a higher level) the timers of
+ * the slot for it are moved down a level. A timer moves down at most three
+ * times, so the cost per timer is O(1) no matter how many there are.
+ */
+#define TIMER_WHEEL_LEVEL_BITS (5U)
+#define TIMER_WHEEL_SLOT_CNT (1U << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOT_CNT - 1U)
+#define TIMER_WHEEL_LEVEL_CNT (3U)
+#define TIMER_WHEEL_LEVEL_SHIFT(level) ((level)*TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_SPAN_MASK(level)                                           \
+    ((1UL << TIMER_WHEEL_LEVEL_SHIFT((level) + 1U)) - 1U)
+
+static bool initialized = false;
+static uint32_t wheel_ms = 0;
+static struct timer_wheel_timer *slots[TIMER_WHEEL_LEVEL_CNT]
+                                      [TIMER_WHEEL_SLOT_CNT];
+static struct timer_wheel_timer *overflow = NULL;
+static struct timer_wheel_timer *deferred = NULL; // Expired, to call back
+// An event to call back the deferred timers is queued, posted again on the
+// next tick if the queue was full
+static volatile bool deferred_posted = false;
+
+static void timer_wheel_link(struct timer_wheel_timer **head,
+                             struct timer_wheel_timer *timer) {
+    timer->next = *head;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void timer_wheel_unlink(struct timer_wheel_timer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void timer_wheel_insert(struct timer_wheel_timer *timer) {
+    const uint32_t diff = timer->expiry_ms ^ wheel_ms;
+    for (uint8_t level = 0; level < TIMER_WHEEL_LEVEL_CNT; level++) {
+        if (!(diff & ~TIMER_WHEEL_SPAN_MASK(level))) {
+            const uint8_t slot =
+                (timer->expiry_ms >> TIMER_WHEEL_LEVEL_SHIFT(level)) &
+                TIMER_WHEEL_SLOT_MASK;
+            timer_wheel_link(&slots[level][slot], timer);
+            return;
+        }
+    }
+    timer_wheel_link(&overflow, timer);
+}
+
+// Move the timers of a slot down now that its span has started
+static void timer_wheel_cascade(struct timer_wheel_timer **head) {
+    struct timer_wheel_timer *timer = *head;
+    *head = NULL;
+    while (timer) {
+        struct timer_wheel_timer *next = timer->next;
+        timer_wheel_insert(timer);
+        timer = next;
+    }
+}
+
+// Runs in the system tick ISR
+static void timer_wheel_tick(void) {
+    wheel_ms++;
+    for (uint8_t level = TIMER_WHEEL_LEVEL_CNT; level > 0; level--) {
+        if (wheel_ms & TIMER_WHEEL_SPAN_MASK(level - 1U)) {
+            continue;
+        }
+        if (level == TIMER_WHEEL_LEVEL_CNT) {
+            timer_wheel_cascade(&overflow);
+        } else {
+            const uint8_t slot =
+                (wheel_ms >> TIMER_WHEEL_LEVEL_SHIFT(level)) &
+                TIMER_WHEEL_SLOT_MASK;
+            timer_wheel_cascade(&slots[level][slot]);
+        }
+    }
+
+    struct timer_wheel_timer **head =
+        &slots[0][wheel_ms & TIMER_WHEEL_SLOT_MASK];
+    while (*head) {
+        struct timer_wheel_timer *timer = *head;
+        timer_wheel_unlink(timer);
+        if (timer->context == TIMER_WHEEL_ISR) {
+            timer->pending = false;
+            timer->cb();
+        } else {
+            timer_wheel_link(&deferred, timer);
+        }
+    }
+    if (deferred && !deferred_posted) {
+        deferred_posted = event_post(EVENT_TIMER, 0);
+    }
+}
+
+static void timer_wheel_handle_deferred(const struct event *event) {
+    (void)event;
+    // Before taking the timers, so one that expires meanwhile posts again
+    deferred_posted = false;
+    while (1) {
+        struct timer_wheel_timer *timer;
+        {
+            CRITICAL_SECTION_BEGIN();
+            timer = deferred;
+            if (timer) {
+                timer_wheel_unlink(timer);
+                timer->pending = false;
+            }
+            CRITICAL_SECTION_END();
+        }
+        if (!timer) {
+            break;
+        }
+        timer->cb();
+    }
+}
+
+void timer_wheel_init(void) {
+    ASSERT(!initialized);
+    event_register_handler(EVENT_TIMER, timer_wheel_handle_deferred);
+    systick_register_tick_cb(timer_wheel_tick);
+    initialized = true;
+}
+
+void timer_wheel_init_timer(struct timer_wheel_timer *timer, timer_wheel_cb cb,
+                            timer_wheel_context_enum context) {
+    ASSERT(cb);
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expiry_ms = 0;
+    timer->cb = cb;
+    timer->context = context;
+    timer->pending = false;
+}
+
+/**
+ * (Re)start the timer, it expires in at least delay_ms (at most one more).
+ * Can be called from an ISR, including from a timer callback.
+ */
+void timer_wheel_start(struct timer_wheel_timer *timer, uint32_t delay_ms) {
+    ASSERT(initialized);
+    ASSERT(timer->cb);
+    ASSERT((delay_ms < INT32_MAX));
+    CRITICAL_SECTION_BEGIN();
+    if (timer->pending) {
+        timer_wheel_unlink(timer);
+    }
+    // Plus one, the next tick may come right away
+    timer->expiry_ms = wheel_ms + delay_ms + 1;
+    timer->pending = true;
+    timer_wheel_insert(timer);
+    CRITICAL_SECTION_END();
+}
+
+/**
+ * Stop the timer if it's pending, its callback won't be called
+ */
+void timer_wheel_cancel(struct timer_wheel_timer *timer) {
+    CRITICAL_SECTION_BEGIN();
+    if (timer->pending) {
+        timer_wheel_unlink(timer);
+        timer->pending = false;
+    }
+    CRITICAL_SECTION_END();
+}
+
+bool timer_wheel_is_pending(const struct timer_wheel_timer *timer) {
+    return timer->pending;
+}
@@ -0,0 +1,34 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Software timers on the system tick, any number of them share the one
+ * hardware timer. Starting, cancelling and expiring a timer are O(1), timers
+ * are sorted into buckets by expiry time instead of each being polled. */
+
+typedef void (*timer_wheel_cb)(void);
+
+typedef enum {
+    TIMER_WHEEL_ISR,     // Call back from the system tick ISR, keep it short
+    TIMER_WHEEL_DEFERRED // Call back from the main loop (see event.h)
+} timer_wheel_context_enum;
+
+// Owned by the timer wheel, only set up with timer_wheel_init_timer()
+struct timer_wheel_timer {
+    struct timer_wheel_timer *next;
+    struct timer_wheel_timer **pprev; // The next pointer (or head) to this
+    uint32_t expiry_ms;
+    timer_wheel_cb cb;
+    timer_wheel_context_enum context;
+    bool pending;
+};
+
+void timer_wheel_init(void);
+void timer_wheel_init_timer(struct timer_wheel_timer *timer, timer_wheel_cb cb,
+                            timer_wheel_context_enum context);
+void timer_wheel_start(struct timer_wheel_timer *timer, uint32_t delay_ms);
+void timer_wheel_cancel(struct timer_wheel_timer *timer);
+bool timer_wheel_is_pending(const struct timer_wheel_timer *timer);
+
+#endif // TIMER_WHEEL_H
@@ -4,8 +4,14 @@
 #include "drivers/uart.h"
 #include "externals/printf/printf.h"
 #include <stdbool.h>
+#include <stdint.h>
+
+// Longer lines are cut short in non-blocking mode
+#define TRACE_LINE_SIZE (128U)
 
 static bool initialized = false;
+static bool nonblocking = false;
+static uint16_t dropped_cnt = 0;
 
 /**
  * Initialize UART
@@ -16,6 +22,32 @@ void trace_init(void) {
     initialized = true;
 }
 
+/**
+ * By default trace() waits until every character is sent. In non-blocking mode
+ * a line is queued for the UART TX interrupt instead, or dropped if the UART
+ * buffer has no room for it, so tracing never stalls a time-triggered task.
+ */
+void trace_set_nonblocking(bool enable) {
+    ASSERT(initialized);
+    nonblocking = enable;
+}
+
+/**
+ * Number of lines dropped in non-blocking mode, saturates at UINT16_MAX
+ */
+uint16_t trace_get_dropped_cnt(void) { return dropped_cnt; }
+
+static void trace_nonblocking(const char *format, va_list args_list) {
+    char line[TRACE_LINE_SIZE];
+    if (vsnprintf(line, sizeof(line), format, args_list) >=
+        (int)sizeof(line)) {
+        line[sizeof(line) - 2U] = '\n'; // Keep the line ending of a cut line
+    }
+    if (!uart_puts_interrupt(line) && dropped_cnt < UINT16_MAX) {
+        dropped_cnt++;
+    }
+}
+
 /**
  * Wrapper for printf function
  *
@@ -31,9 +63,14 @@ void trace(const char *format, ...) {
     va_start(args_list,
              format); // Initialize the va_list object with the arguments,
                       // starting after the variable "format" as the identifier
-    vprintf(format, args_list); // Same as printf, but using variable arguments
-                                // (va_list object) (in stdio.h, but also a
-                                // macro in externals/printf/printf.h)
-    va_end(args_list);          // Clean up va_list object when done using it
+    if (nonblocking) {
+        trace_nonblocking(format, args_list);
+    } else {
+        vprintf(format, args_list); // Same as printf, but using variable
+                                    // arguments (va_list object) (in stdio.h,
+                                    // but also a macro in
+                                    // externals/printf/printf.h)
+    }
+    va_end(args_list); // Clean up va_list object when done using it
 }
 #endif
@@ -1,11 +1,17 @@
+#include <stdbool.h>
+#include <stdint.h>
 
 #define TRACE(fmt, ...)                                                        \
     trace("%s:%d: " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__)
 
 #ifndef DISABLE_TRACE
 void trace_init(void);
+void trace_set_nonblocking(bool enable);
+uint16_t trace_get_dropped_cnt(void);
 void trace(const char *format, ...);
 #else
 #define trace_init() ;
+#define trace_set_nonblocking(enable) ;
+#define trace_get_dropped_cnt() (0U)
 #define trace(fmt, ...) ;
 #endif
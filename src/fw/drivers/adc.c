@@ -1,10 +1,15 @@
 #include "drivers/adc.h"
 #include "common/assert_handler.h"
 #include "common/defines.h"
+#include "common/event.h"
+#include "common/prof.h"
 #include "common/trace.h"
+#include "drivers/debug_marker.h"
 #include "drivers/io.h"
+#include <assert.h>
 #include <msp430.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -15,12 +20,40 @@
  * values from the cache. Use DMA (DTC) and slow clock (ACLK) to reduce CPU
  * involved. Using a slower clock means less interrupts, so less CPU
  * involvement.
+ *
+ * Consumers that need to react to a new sequence immediately (e.g. the line
+ * detection reflex) can register a callback that is invoked from the DMA ISR,
+ * instead of waiting for the application to poll the cache.
+ *
+ * The conversion sequence (ADC12MCTLx), the DMA transfer size and the buffer
+ * size are all generated from IO_ADC_PINS at compile time. The sequence
+ * starts at ADC12MEM0 and ends with ADC12EOS on the last pin, so adding or
+ * moving an analog input only needs a change to the pin map.
  */
-static const io_signal_enum *adc_pins;
-static uint8_t adc_pin_cnt;
+#define ADC_MEM_CNT (16U) // ADC12MEM0-15 / ADC12MCTL0-15
+
+#define ADC_PIN_ASSERT(pin)                                                    \
+    static_assert(IO_ADC_IS_ANALOG_PIN(pin), #pin " is not an analog input");
+IO_ADC_PINS(ADC_PIN_ASSERT)
+static_assert(ADC_CHANNEL_COUNT > 0, "No ADC pins");
+static_assert(ADC_CHANNEL_COUNT <= ADC_MEM_CNT, "Too many ADC pins");
+
+/**
+ * ADC12MCTLx
+ * ADC12EOS: Current register indicate end of sampling sequence
+ * ADC12INCHx: Select input channel for the corresponding ADC12MEMx
+ * ADC12SREFx: Select the reference voltage (0: AVCC, AVSS)
+ */
+#define ADC_MCTL_ENTRY(pin)                                                    \
+    (uint8_t)(IO_ADC_INPUT_CHANNEL(pin) + ADC12SREF_0 +                        \
+              (ADC_CHANNEL_##pin == ADC_CHANNEL_CNT - 1 ? ADC12EOS : 0)),
+static const uint8_t adc_mctl[ADC_CHANNEL_COUNT] = {
+    IO_ADC_PINS(ADC_MCTL_ENTRY)};
+
 static bool initialized = false;
 static volatile adc_channel_values_t
-    adc_dma_buffer; // Array of uint16_6 of size ADC_CHANNEL_COUNT (8)
+    adc_dma_buffer; // Array of uint16_t of size ADC_CHANNEL_COUNT
+static adc_conversion_cb conversion_cb = NULL;
 
 /**
  * Enable ADC12 and start sampling and conversion
@@ -33,7 +66,6 @@ static void adc_enable_and_start_conversion(void) {
 
 void adc_init(void) {
     ASSERT(!initialized);
-    adc_pins = get_io_adc_pins(&adc_pin_cnt);
 
     /**
      * ADC12CTL0
@@ -45,10 +77,12 @@ void adc_init(void) {
 
     /**
      * ADC12CTL1
-     * ARC12CSTARTADDx: 1 (Use ADC12MEM1 as the conversion start address, and
-     * the conversion sequence ends at ADC12MCTL4 (connected to ADCMEM4 and
-     * sequence ends because set ADC12EOS in ADC12MCTL4) ADC12DIVx: ADC12 clock
-     * source divider ADC12SSELx: ADC12 clock source selector (1: ACLK)
+     * ARC12CSTARTADDx: 0 (Use ADC12MEM0 as the conversion start address, and
+     * the conversion sequence ends at the ADC12MCTLx with ADC12EOS set, which
+     * is the last pin in IO_ADC_PINS) ADC12DIVx: ADC12 clock
+     * source divider (7: divide by 8) ADC12SSELx: ADC12 clock source selector
+     * (0: ADC12OSC/MODOSC, ACLK from the VLO made one sequence take ~250ms,
+     * which is far too slow to react to the line)
      * ADC12SHSx: Sample and hold source select (0: ADC12SC bit). Conversions
      * for the sequence of channels are triggered by a rising edge of this bit.
      * This acts as the SHI signal, which will trigger sampling on rising edge.
@@ -62,7 +96,7 @@ void adc_init(void) {
      * SHI signal starts sampling, and timer clock cycles stop sampling instead
      * of falling edge of SHI signal)
      */
-    ADC12CTL1 = ADC12CSTARTADD_1 + ADC12DIV_7 + ADC12SSEL_1 + ADC12SHS_0 +
+    ADC12CTL1 = ADC12CSTARTADD_0 + ADC12DIV_7 + ADC12SSEL_0 + ADC12SHS_0 +
                 ADC12CONSEQ_1 + ADC12SHP;
 
     /**
@@ -74,25 +108,16 @@ void adc_init(void) {
      */
     ADC12CTL2 = ADC12RES_2;
 
-    /**
-     * ADC12MCTLx
-     * ADC12EOS: Current register indicate end of sampling sequence
-     * ADC12INCHx: Select input channel for the corresponding ADC12MEMx
-     * ADC12SREFx: Select the reference voltage (0: AVCC, AVSS)
-     */
-    ADC12MCTL1 = ADC12INCH_1 + ADC12SREF_0;
-    ADC12MCTL2 = ADC12INCH_2 + ADC12SREF_0;
-    ADC12MCTL3 = ADC12INCH_3 + ADC12SREF_0;
-    ADC12MCTL4 =
-        ADC12EOS + ADC12INCH_4 +
-        ADC12SREF_0; // Setting ADC12EOS means this input channel will represent
-                     // the end of a sequence. Only need to sample up to channel
-                     // 4, even though there are 15 channels.
+    // ADC12MCTLx are byte registers laid out back to back
+    volatile uint8_t *mctl = &ADC12MCTL0;
+    uint8_t i;
+    for (i = 0; i < ADC_CHANNEL_COUNT; i++) {
+        mctl[i] = adc_mctl[i];
+    }
 
     /**
      * ADC12IEx
      * Enable interrupts for ADC12IFGx
-     * Using Analog-In A1,A2,A3,A4
      */
     // ADC12IE = ADC12IE1 + ADC12IE2 + ADC12IE3;
 
@@ -107,8 +132,8 @@ void adc_init(void) {
      * DMA
      * Use DMA0 (channel 0 out of 0/1/2) to transfer ADC conversions (channel
      * 3-7 not implemented on MSP430F5529) Select DMA to act as trigger for
-     * transferring the block of ADC converted data when the ADC12MEM4 IFG is
-     * set
+     * transferring the block of ADC converted data when the IFG of the last
+     * ADC12MEMx in the sequence is set
      */
     DMA0CTL &= ~DMAEN; // Disable DMA0 while configuring
     DMACTL0 |= DMA0TSEL__ADC12IFG;
@@ -129,23 +154,27 @@ void adc_init(void) {
      * DMAEN: 1 (Enable DMA)
      */
     DMA0CTL = DMADT_1 | DMADSTINCR_3 | DMASRCINCR_3 | DMAIE;
-    DMA0SA = (uint16_t)&ADC12MEM1;
+    DMA0SA = (uint16_t)&ADC12MEM0;
     DMA0DA = (uint16_t)adc_dma_buffer; // Destination array in RAM to store
                                        // values transferred by DMA
-    DMA0SZ = (uint16_t)4; // Number of bytes/words to transfer (decrements after
-                          // each transfer until reaching 0)
-    DMA0CTL |= DMAEN;     // Enable DMA0 after done configuring
-                          //
+    DMA0SZ = ADC_CHANNEL_COUNT; // Number of bytes/words to transfer
+                                // (decrements after each transfer until
+                                // reaching 0)
+    DMA0CTL |= DMAEN;           // Enable DMA0 after done configuring
+                                //
     adc_enable_and_start_conversion();
 
     initialized = true;
 }
 
-INTERRUPT_FUNCTION(DMA_VECTOR) isr_dma(void) {
+PROF_INTERRUPT_FUNCTION(DMA_VECTOR, isr_dma, PROF_ISR_ADC_DMA,
+                        PROF_LATENCY_UNKNOWN) {
+    PROF_BEGIN(PROF_ISR_DMA);
     switch (__even_in_range(DMAIV, DMAIV_DMA2IFG)) {
     case DMAIV_NONE:
         break;
     case DMAIV_DMA0IFG:
+        DEBUG_MARKER_HIGH(DEBUG_MARKER_ADC_DMA);
         ADC12CTL0 &= ~ADC12SC; // Need to manually reset ADC12SC bit to trigger
                                // another ADC sample and conversion
         DMA0CTL |= DMAEN; // Need to re-enable DMA because this bit is cleared
@@ -153,6 +182,12 @@ INTERRUPT_FUNCTION(DMA_VECTOR) isr_dma(void) {
         adc_enable_and_start_conversion(); // Start an ADC sample and conversion
                                            // after transferring previous
                                            // conversion through DMA
+        // The next sequence is sampled while the callback runs, the buffer is
+        // only overwritten once that whole sequence has been converted
+        if (conversion_cb) {
+            conversion_cb(adc_dma_buffer);
+        }
+        DEBUG_MARKER_LOW(DEBUG_MARKER_ADC_DMA);
         break;
     case DMAIV_DMA1IFG:
         break;
@@ -161,6 +196,8 @@ INTERRUPT_FUNCTION(DMA_VECTOR) isr_dma(void) {
     default:
         break;
     }
+    PROF_END(PROF_ISR_DMA);
+    EVENT_WAKE_ON_EXIT_IF_PENDING();
 }
 
 void adc_get_channel_values(adc_channel_values_t buffer) {
@@ -172,3 +209,13 @@ void adc_get_channel_values(adc_channel_values_t buffer) {
     }
     __enable_interrupt();
 }
+
+/**
+ * Register a function to be called from the DMA ISR each time a sequence of
+ * conversions has been transferred. Keep it short, it runs in ISR context and
+ * must finish before the next sequence is transferred (ADC_SEQUENCE_PERIOD_US).
+ */
+void adc_register_conversion_cb(adc_conversion_cb cb) {
+    ASSERT(!conversion_cb);
+    conversion_cb = cb;
+}
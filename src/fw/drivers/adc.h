@@ -1,9 +1,35 @@
-
+#ifndef ADC_H
+#define ADC_H
+#include "drivers/io.h"
 #include <stdint.h>
 
-#define ADC_CHANNEL_COUNT (4U) // There are 8 channels, but only using 4 (A1-4)
+// One channel per pin in IO_ADC_PINS, in the same order as they are sampled
+#define ADC_CHANNEL_ENTRY(pin) ADC_CHANNEL_##pin,
+typedef enum {
+    IO_ADC_PINS(ADC_CHANNEL_ENTRY) ADC_CHANNEL_CNT
+} e__adc_channel;
+#undef ADC_CHANNEL_ENTRY
+
+#define ADC_CHANNEL_COUNT ((uint8_t)ADC_CHANNEL_CNT)
+
+/**
+ * ADC12 is clocked from MODOSC (ADC12OSC, ~4.8MHz typical) divided by 8, and
+ * every channel takes 64 sample-and-hold cycles + 13 conversion cycles. One
+ * sequence over all channels therefore completes every ~0.5ms, which is the
+ * upper bound on how stale a value handed out by this driver can be.
+ */
+#define ADC_CLOCK_HZ (4800000UL / 8U)
+#define ADC_CYCLES_PER_CHANNEL (64U + 13U)
+#define ADC_SEQUENCE_PERIOD_US                                                 \
+    ((ADC_CYCLES_PER_CHANNEL * ADC_CHANNEL_COUNT * 1000000UL) / ADC_CLOCK_HZ)
 
 typedef uint16_t adc_channel_values_t[ADC_CHANNEL_COUNT];
 
+// Called from the DMA ISR every time a new sequence of channels is available
+typedef void (*adc_conversion_cb)(const volatile uint16_t *values);
+
 void adc_init(void);
 void adc_get_channel_values(adc_channel_values_t values);
+void adc_register_conversion_cb(adc_conversion_cb cb);
+
+#endif // ADC_H
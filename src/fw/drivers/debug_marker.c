@@ -0,0 +1,35 @@
+#ifdef DEBUG_MARKERS
+#include "drivers/debug_marker.h"
+#include "common/assert_handler.h"
+#include "common/defines.h"
+#include "drivers/io.h"
+#include <stdbool.h>
+
+static bool initialized = false;
+
+static const io_signal_enum markers[] = {
+    DEBUG_MARKER_RANGE_ISR,
+    DEBUG_MARKER_ADC_DMA,
+    DEBUG_MARKER_LINE,
+    DEBUG_MARKER_PWM,
+};
+
+/**
+ * Turn the marker pins from unused inputs into outputs, after io_init()
+ */
+void debug_marker_init(void) {
+    ASSERT(!initialized);
+    const struct io_config unused_config = {IO_SEL_GPIO, IO_DIR_INPUT,
+                                            IO_REN_ENABLE, IO_OUT_LOW};
+    const struct io_config marker_config = {IO_SEL_GPIO, IO_DIR_OUTPUT,
+                                            IO_REN_DISABLE, IO_OUT_LOW};
+    for (uint8_t i = 0; i < ARRAY_SIZE(markers); i++) {
+        struct io_config current_config;
+        io_get_current_config(markers[i], &current_config);
+        // Don't take over a pin that has been put to use
+        ASSERT(io_config_compare(&current_config, &unused_config));
+        config_io(markers[i], &marker_config);
+    }
+    initialized = true;
+}
+#endif
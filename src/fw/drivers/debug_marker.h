@@ -0,0 +1,36 @@
+#ifndef DEBUG_MARKER_H
+#define DEBUG_MARKER_H
+#include "drivers/io.h"
+#include <msp430.h>
+#include <stdint.h>
+
+/* Spare pins driven at points of interest, to measure latencies (e.g. from
+ * a sensor to the motors) with a logic analyser. Build with -DDEBUG_MARKERS
+ * (make MARKERS=1) to enable them, otherwise the markers compile to nothing
+ * and the pins stay unused. The pin of a marker is known at compile time, so
+ * setting it is a single BIS.B/BIC.B/XOR.B on its port register. */
+
+// Markers are named after their pin, unused on both boards and on the
+// LaunchPad headers
+#define DEBUG_MARKER_RANGE_ISR IO_UNUSED_30 // P3.0, range sensor done ISR
+#define DEBUG_MARKER_ADC_DMA IO_UNUSED_31   // P3.1, ADC sequence transferred
+#define DEBUG_MARKER_LINE IO_UNUSED_32      // P3.2, high while a line is seen
+#define DEBUG_MARKER_PWM IO_UNUSED_27       // P2.7, duty cycles committed
+
+#ifdef DEBUG_MARKERS
+#define DEBUG_MARKER_HIGH(marker)                                              \
+    (IO_PORT_OUT_REG(marker) |= IO_PIN_BIT(marker))
+#define DEBUG_MARKER_LOW(marker)                                               \
+    (IO_PORT_OUT_REG(marker) &= ~IO_PIN_BIT(marker))
+#define DEBUG_MARKER_TOGGLE(marker)                                            \
+    (IO_PORT_OUT_REG(marker) ^= IO_PIN_BIT(marker))
+
+void debug_marker_init(void);
+#else
+#define DEBUG_MARKER_HIGH(marker) ((void)0)
+#define DEBUG_MARKER_LOW(marker) ((void)0)
+#define DEBUG_MARKER_TOGGLE(marker) ((void)0)
+#define debug_marker_init() ;
+#endif
+
+#endif // DEBUG_MARKER_H
@@ -1,18 +1,113 @@
 #include "drivers/drv8848.h"
 #include "common/assert_handler.h"
-#include "common/trace.h"
+#include "common/defines.h"
 #include "drivers/io.h"
 #include "drivers/pwm.h"
+#include "drivers/ring_buffer.h"
 #include <assert.h>
+#include <msp430.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/**
+ * nFAULT handling:
+ * The nFAULT pins (P7.4, P4.3) are not on an interrupt capable port, so they
+ * are sampled at the end of every PWM period instead (every 50us) from the
+ * PWM timer ISR. On a fault both drivers are put to sleep and all PWM outputs
+ * are disabled right away, an event is queued for later reporting, and the
+ * drivers are re-enabled after a backoff that doubles with every consecutive
+ * fault. The backoff resets once the drivers have run without fault for a
+ * while.
+ */
+#define DRV8848_WAKE_PERIODS (1U * PWM_PERIODS_PER_MS) // tWAKE is up to 1ms
+#define DRV8848_BACKOFF_MIN_PERIODS (100U * PWM_PERIODS_PER_MS)
+#define DRV8848_BACKOFF_MAX_PERIODS (3000U * PWM_PERIODS_PER_MS)
+#define DRV8848_HEALTHY_PERIODS (1000U * PWM_PERIODS_PER_MS)
+#define DRV8848_FAULT_EVENTS_SIZE (8U)
+static_assert(DRV8848_BACKOFF_MAX_PERIODS <= UINT16_MAX,
+              "Backoff doesn't fit uint16_t");
+
 static bool initialized = false;
+static bool enabled = false;               // Requested by the user
+static volatile bool fault_active = false; // Drivers put to sleep on fault
+static uint16_t wait_periods = 0; // Ignore nFAULT (waking up) or backoff
+static uint16_t backoff_periods = DRV8848_BACKOFF_MIN_PERIODS;
+static uint16_t healthy_periods = 0;
+static uint8_t consecutive_faults = 0;
+static struct ring_buffer *fault_events = NULL;
 
 static const drv8848_enum motor_sides[][2] = {
     [MOTORS_RIGHT] = {DRV8848_RIGHT1, DRV8848_RIGHT2},
     [MOTORS_LEFT] = {DRV8848_LEFT1, DRV8848_LEFT2}};
 
+// Current duty cycle (permille) of every driver input
+static uint16_t duty_cycles[DRV8848_CNT] = {0};
+
+/**
+ * Calibration:
+ * The motors differ, so the same duty cycle doesn't give the same speed, and
+ * low duty cycles stall within the deadband. Every motor and direction has a
+ * calibration (deadband and max duty cycle) that is expanded into a lookup
+ * table of DRV8848_CAL_POINT_CNT points spaced 64 permille apart. A command
+ * is converted by interpolating between two points (one multiply and a
+ * shift) right before it becomes driver inputs, so the slew limiter still
+ * ramps in command space. Fill in drv8848_default_calibration with the values
+ * found with test_drv8848_calibration.
+ */
+#define DRV8848_CAL_SEGMENT_SHIFT (6U)
+#define DRV8848_CAL_SEGMENT_MASK ((1U << DRV8848_CAL_SEGMENT_SHIFT) - 1U)
+#define DRV8848_CAL_POINT_CNT ((PWM_DUTY_MAX >> DRV8848_CAL_SEGMENT_SHIFT) + 2U)
+
+static const struct drv8848_calibration
+    drv8848_default_calibration[MOTORS_SIDE_CNT][DRV8848_DIR_CNT] = {
+        [MOTORS_RIGHT] = {[DRV8848_DIR_FORWARD] = {0, PWM_DUTY_MAX},
+                          [DRV8848_DIR_REVERSE] = {0, PWM_DUTY_MAX}},
+        [MOTORS_LEFT] = {[DRV8848_DIR_FORWARD] = {0, PWM_DUTY_MAX},
+                         [DRV8848_DIR_REVERSE] = {0, PWM_DUTY_MAX}}};
+static struct drv8848_calibration calibrations[MOTORS_SIDE_CNT]
+                                              [DRV8848_DIR_CNT];
+static uint16_t calibration_lut[MOTORS_SIDE_CNT][DRV8848_DIR_CNT]
+                               [DRV8848_CAL_POINT_CNT];
+
+/**
+ * Slew limiter:
+ * Jumping straight from full reverse to full forward causes current spikes
+ * (tripping nFAULT and browning out the sensors on the shared supply) and
+ * wheel slip. Instead, the requested duty cycle of each motor is only the
+ * target, and the duty cycle actually applied is ramped towards it at the end
+ * of every PWM period from the PWM period ISR. Moving away from 0 is limited
+ * by the accel rate, moving towards 0 by the decel rate, and a direction
+ * change first decelerates to 0. Braking and unlimited commands bypass the
+ * ramp. The ramp is kept in 1/32 permille, so rates of a few permille per
+ * millisecond still step every period, and the driver inputs are only updated
+ * when the permille value changes.
+ */
+#define DRV8848_SLEW_ACCEL_DEFAULT (5U)  // 0 to full in 200ms
+#define DRV8848_SLEW_DECEL_DEFAULT (10U) // Full to 0 in 100ms
+#define DRV8848_SLEW_FRAC_SHIFT (5U)
+// Step in 1/32 permille per PWM period, never rounded down to unlimited (0)
+#define DRV8848_SLEW_STEP(rate)                                                \
+    ((rate) == DRV8848_SLEW_UNLIMITED                                          \
+         ? 0U                                                                  \
+         : (((rate) << DRV8848_SLEW_FRAC_SHIFT) + PWM_PERIODS_PER_MS - 1U) /   \
+               PWM_PERIODS_PER_MS)
+static_assert(((int32_t)PWM_DUTY_MAX << DRV8848_SLEW_FRAC_SHIFT) <= INT16_MAX,
+              "Ramp doesn't fit int16_t");
+
+struct drv8848_side_state {
+    drv8848_mode_enum mode; // Requested mode
+    int16_t target;         // Requested duty cycle, > 0 forward, < 0 reverse
+    int16_t actual;         // Duty cycle applied, ramped towards target
+    int16_t ramp;           // actual in 1/32 permille
+    bool slow_decay;        // Use the slow decay modes for actual
+};
+static volatile struct drv8848_side_state side_states[MOTORS_SIDE_CNT] = {
+    {DRV8848_MODE_COAST, 0, 0, 0, false}, {DRV8848_MODE_COAST, 0, 0, 0, false}};
+static uint16_t slew_accel_step = DRV8848_SLEW_STEP(DRV8848_SLEW_ACCEL_DEFAULT);
+static uint16_t slew_decel_step = DRV8848_SLEW_STEP(DRV8848_SLEW_DECEL_DEFAULT);
+static volatile uint16_t brake_periods = 0; // Brake pulse, coast afterwards
+
 /**
  * Checks io pins (besides the PWM inputs) for motor drivers are configured
  * correctly
@@ -41,80 +136,406 @@ static void drv8848_assert_io_config(void) {
                              &curr_motor_left_nfault_config));
 }
 
-/**
- * Initializes motor driver PWM and checks IO configuration
- * for other pins of motor driver (enable and nFAULT)
- */
-void drv8848_init(void) {
-    ASSERT(!initialized);
+static inline void drv8848_set_sleep(bool sleep) {
+    // Single instruction on a fixed address, safe from ISR and main context
+    if (sleep) {
+        IO_PORT_OUT_REG(MOTOR_ENABLE) &= ~IO_PIN_BIT(MOTOR_ENABLE);
+    } else {
+        IO_PORT_OUT_REG(MOTOR_ENABLE) |= IO_PIN_BIT(MOTOR_ENABLE);
+    }
+}
 
-    pwm_init();
-    drv8848_assert_io_config();
-    drv8848_enable(true); // Enable both motor drivers
-    initialized = true;
+static inline uint8_t drv8848_read_faults(void) {
+    uint8_t faults = 0;
+    if (!(IO_PORT_IN_REG(MOTOR_RIGHT_NFAULT) &
+          IO_PIN_BIT(MOTOR_RIGHT_NFAULT))) {
+        faults |= DRV8848_FAULT_RIGHT;
+    }
+    if (!(IO_PORT_IN_REG(MOTOR_LEFT_NFAULT) & IO_PIN_BIT(MOTOR_LEFT_NFAULT))) {
+        faults |= DRV8848_FAULT_LEFT;
+    }
+    return faults;
 }
 
 /**
- * Set the mode of the motor driver
- * Mode depends on state of PWM inputs
+ * Update the cached driver inputs of one side for the given mode
  */
-void drv8848_set_mode(motor_side_enum side, drv8848_mode_enum mode,
-                      uint8_t duty_cycle) {
+static void drv8848_mode_to_inputs(motor_side_enum side,
+                                   drv8848_mode_enum mode,
+                                   uint16_t duty_cycle) {
     /**
      * xIN1 xIN2 xOUT1 xOUT2 Function (DC Motor)
      * 0    0    Z     Z     Coast (fast decay)
      * 0    1    L     H     Reverse
      * 1    0    H     L     Forward
      * 1    1    L     L     Brake (slow decay)
+     *
+     * Forward/reverse PWM one input and keep the other low, so the motor
+     * current decays through coast (fast decay) in the off-time. The slow
+     * decay modes instead keep one input high and PWM the other (inverted),
+     * so the off-time brakes the motor. This holds the speed better at low
+     * duty cycles and slows down faster when the duty cycle drops.
      */
+    uint16_t *in1 = &duty_cycles[motor_sides[side][0]];
+    uint16_t *in2 = &duty_cycles[motor_sides[side][1]];
     switch (mode) {
     case DRV8848_MODE_COAST:
         // Set both inputs to LOW (0% duty cycle)
-        drv8848_set_pwm(motor_sides[side][0],
-                        0); // Set left/right motor xIN1 to 0% duty cycle
-        drv8848_set_pwm(motor_sides[side][1],
-                        0); // Set left/right motor xIN2 to 0% duty cycle
-        // drv8848_set_pwm(DRV8848_RIGHT1, 0);
-        // drv8848_set_pwm(DRV8848_RIGHT2, 0);
-        // drv8848_set_pwm(DRV8848_LEFT1, 0);
-        // drv8848_set_pwm(DRV8848_LEFT2, 0);
+        *in1 = 0;
+        *in2 = 0;
         break;
     case DRV8848_MODE_FORWARD:
         // PWM xIN1, Disable xIN2
-        drv8848_set_pwm(
-            motor_sides[side][0],
-            duty_cycle); // Set left/right motor xIN1 to current duty cycle
-        drv8848_set_pwm(motor_sides[side][1],
-                        0); // Set left/right motor xIN2 to 0% duty cycle
-        // drv8848_set_pwm(DRV8848_RIGHT1, curr_pwm_dutycycle);
-        // drv8848_set_pwm(DRV8848_RIGHT2, 0);
-        // drv8848_set_pwm(DRV8848_LEFT1, curr_pwm_dutycycle);
-        // drv8848_set_pwm(DRV8848_LEFT2, 0);
+        *in1 = duty_cycle;
+        *in2 = 0;
         break;
     case DRV8848_MODE_REVERSE:
         // Disable xIN1, PWM xIN2
-        drv8848_set_pwm(motor_sides[side][0],
-                        0); // Set left/right motor xIN1 to 0% duty cycle
-        drv8848_set_pwm(
-            motor_sides[side][1],
-            duty_cycle); // Set left/right motor xIN2 to current duty cycle
-        // drv8848_set_pwm(DRV8848_RIGHT1, 0);
-        // drv8848_set_pwm(DRV8848_RIGHT2, curr_pwm_dutycycle);
-        // drv8848_set_pwm(DRV8848_LEFT1, 0);
-        // drv8848_set_pwm(DRV8848_LEFT2, curr_pwm_dutycycle);
+        *in1 = 0;
+        *in2 = duty_cycle;
+        break;
+    case DRV8848_MODE_STOP:
+        // Enable both inputs (constantly high)
+        *in1 = PWM_DUTY_INVERTED;
+        *in2 = PWM_DUTY_INVERTED;
+        break;
+    case DRV8848_MODE_FORWARD_SLOW_DECAY:
+        // Keep xIN1 high, xIN2 low during the duty cycle and high otherwise
+        *in1 = PWM_DUTY_INVERTED;
+        *in2 = PWM_DUTY_INVERTED | duty_cycle;
+        break;
+    case DRV8848_MODE_REVERSE_SLOW_DECAY:
+        // Keep xIN2 high, xIN1 low during the duty cycle and high otherwise
+        *in1 = PWM_DUTY_INVERTED | duty_cycle;
+        *in2 = PWM_DUTY_INVERTED;
+        break;
+    }
+}
+
+/**
+ * Convert a command (permille) to the calibrated duty cycle
+ */
+static inline uint16_t drv8848_calibrate(motor_side_enum side,
+                                         drv8848_dir_enum dir,
+                                         uint16_t command) {
+    if (!command) {
+        return 0;
+    }
+    const uint16_t *lut = calibration_lut[side][dir];
+    const uint8_t idx = command >> DRV8848_CAL_SEGMENT_SHIFT;
+    const uint16_t frac = command & DRV8848_CAL_SEGMENT_MASK;
+    const uint16_t duty_cycle =
+        lut[idx] + (uint16_t)(((uint32_t)(lut[idx + 1] - lut[idx]) * frac +
+                               (1U << (DRV8848_CAL_SEGMENT_SHIFT - 1U))) >>
+                              DRV8848_CAL_SEGMENT_SHIFT);
+    // The last point lies beyond a full command
+    const uint16_t max = calibrations[side][dir].max;
+    return duty_cycle < max ? duty_cycle : max;
+}
+
+/**
+ * Convert the applied duty cycle of every side to driver inputs and commit
+ * them in one go. Must be called with interrupts disabled.
+ */
+static void drv8848_apply(void) {
+    for (uint8_t side = 0; side < MOTORS_SIDE_CNT; side++) {
+        const int16_t actual = side_states[side].actual;
+        const bool slow_decay = side_states[side].slow_decay;
+        if (side_states[side].mode == DRV8848_MODE_STOP) {
+            drv8848_mode_to_inputs(side, DRV8848_MODE_STOP, 0);
+        } else if (actual > 0) {
+            drv8848_mode_to_inputs(
+                side,
+                slow_decay ? DRV8848_MODE_FORWARD_SLOW_DECAY
+                           : DRV8848_MODE_FORWARD,
+                drv8848_calibrate(side, DRV8848_DIR_FORWARD, actual));
+        } else if (actual < 0) {
+            drv8848_mode_to_inputs(
+                side,
+                slow_decay ? DRV8848_MODE_REVERSE_SLOW_DECAY
+                           : DRV8848_MODE_REVERSE,
+                drv8848_calibrate(side, DRV8848_DIR_REVERSE, -actual));
+        } else {
+            drv8848_mode_to_inputs(
+                side, slow_decay ? DRV8848_MODE_STOP : DRV8848_MODE_COAST, 0);
+        }
+    }
+    if (!fault_active) { // Otherwise applied once the drivers are re-enabled
+        pwm_set_duty_cycles(duty_cycles);
+    }
+}
+
+/**
+ * Step the ramp towards the target (both in 1/32 permille) by at most one slew
+ * step
+ */
+static int16_t drv8848_slew(int16_t ramp, int16_t target) {
+    const bool decel =
+        (ramp > 0 && target < ramp) || (ramp < 0 && target > ramp);
+    const int16_t step = decel ? slew_decel_step : slew_accel_step;
+    if (!step) {
+        return target;
+    }
+    int16_t next;
+    if (target > ramp) {
+        next = target - ramp < step ? target : ramp + step;
+    } else {
+        next = ramp - target < step ? target : ramp - step;
+    }
+    if (decel && ((ramp > 0 && next < 0) || (ramp < 0 && next > 0))) {
+        next = 0; // Stop before changing direction
+    }
+    return next;
+}
+
+/**
+ * Round the ramp towards 0 to permille
+ */
+static inline int16_t drv8848_ramp_to_permille(int16_t ramp) {
+    return ramp >= 0 ? ramp >> DRV8848_SLEW_FRAC_SHIFT
+                     : -(-ramp >> DRV8848_SLEW_FRAC_SHIFT);
+}
+
+static void drv8848_slew_all(void) {
+    bool changed = false;
+    for (uint8_t side = 0; side < MOTORS_SIDE_CNT; side++) {
+        volatile struct drv8848_side_state *state = &side_states[side];
+        const int16_t target = state->target << DRV8848_SLEW_FRAC_SHIFT;
+        if (state->ramp == target) {
+            continue;
+        }
+        state->ramp = drv8848_slew(state->ramp, target);
+        const int16_t actual = drv8848_ramp_to_permille(state->ramp);
+        if (actual != state->actual) {
+            state->actual = actual;
+            changed = true;
+        }
+    }
+    if (changed) {
+        drv8848_apply();
+    }
+}
+
+static void drv8848_handle_fault(uint8_t faults) {
+    drv8848_set_sleep(true);
+    pwm_disable_all();
+    fault_active = true;
+    // Outputs are off, so ramp up from 0 again once re-enabled
+    for (uint8_t side = 0; side < MOTORS_SIDE_CNT; side++) {
+        side_states[side].actual = 0;
+        side_states[side].ramp = 0;
+    }
+    if (consecutive_faults < DRV8848_FAULT_CNT_MAX) {
+        consecutive_faults++;
+    }
+    if (!ring_buffer_isfull(fault_events)) {
+        ring_buffer_push(fault_events,
+                         faults | (consecutive_faults
+                                   << DRV8848_FAULT_EVENT_CNT_OFFSET));
+    }
+    wait_periods = backoff_periods;
+    backoff_periods = backoff_periods >= DRV8848_BACKOFF_MAX_PERIODS / 2
+                          ? DRV8848_BACKOFF_MAX_PERIODS
+                          : backoff_periods * 2;
+    healthy_periods = 0;
+}
+
+/**
+ * Runs at the end of every PWM period (ISR context)
+ */
+static void drv8848_period(void) {
+    if (brake_periods && --brake_periods == 0) {
+        for (uint8_t side = 0; side < MOTORS_SIDE_CNT; side++) {
+            side_states[side].mode = DRV8848_MODE_COAST;
+        }
+        drv8848_apply();
+    }
+    if (!fault_active) {
+        drv8848_slew_all();
+    }
+    if (wait_periods) {
+        wait_periods--;
+        return;
+    }
+    if (fault_active) {
+        // Backoff elapsed, wake up the drivers again
+        fault_active = false;
+        if (enabled) {
+            drv8848_set_sleep(false);
+            drv8848_apply();
+            wait_periods = DRV8848_WAKE_PERIODS;
+        }
+        return;
+    }
+    if (!enabled) {
+        return;
+    }
+    const uint8_t faults = drv8848_read_faults();
+    if (faults) {
+        drv8848_handle_fault(faults);
+    } else if (consecutive_faults &&
+               ++healthy_periods >= DRV8848_HEALTHY_PERIODS) {
+        consecutive_faults = 0;
+        backoff_periods = DRV8848_BACKOFF_MIN_PERIODS;
+    }
+}
+
+/**
+ * Initializes motor driver PWM and checks IO configuration
+ * for other pins of motor driver (enable and nFAULT)
+ */
+void drv8848_init(void) {
+    ASSERT(!initialized);
+
+    pwm_init();
+    drv8848_assert_io_config();
+    for (uint8_t side = 0; side < MOTORS_SIDE_CNT; side++) {
+        for (uint8_t dir = 0; dir < DRV8848_DIR_CNT; dir++) {
+            drv8848_set_calibration(side, dir,
+                                    &drv8848_default_calibration[side][dir]);
+        }
+    }
+    fault_events = ring_buffer_init(DRV8848_FAULT_EVENTS_SIZE);
+    drv8848_enable(true); // Enable both motor drivers
+    pwm_register_period_cb(drv8848_period);
+    initialized = true;
+}
+
+static void drv8848_set_target(motor_side_enum side, drv8848_mode_enum mode,
+                               uint16_t duty_cycle, bool unlimited) {
+    volatile struct drv8848_side_state *state = &side_states[side];
+    state->mode = mode;
+    state->slow_decay = mode == DRV8848_MODE_FORWARD_SLOW_DECAY ||
+                        mode == DRV8848_MODE_REVERSE_SLOW_DECAY;
+    switch (mode) {
+    case DRV8848_MODE_FORWARD:
+    case DRV8848_MODE_FORWARD_SLOW_DECAY:
+        state->target = duty_cycle;
         break;
+    case DRV8848_MODE_REVERSE:
+    case DRV8848_MODE_REVERSE_SLOW_DECAY:
+        state->target = -(int16_t)duty_cycle;
+        break;
+    case DRV8848_MODE_COAST:
     case DRV8848_MODE_STOP:
-        // Enable both inputs
-        drv8848_set_pwm(motor_sides[side][0],
-                        100); // Set left/right motor xIN1 to 100% duty cycle
-        drv8848_set_pwm(motor_sides[side][1],
-                        100); // Set left/right motor xIN2 to 100% duty cycle
-        // drv8848_set_pwm(DRV8848_RIGHT1, 100);
-        // drv8848_set_pwm(DRV8848_RIGHT2, 100);
-        // drv8848_set_pwm(DRV8848_LEFT1, 100);
-        // drv8848_set_pwm(DRV8848_LEFT2, 100);
+        state->target = 0;
         break;
     }
+    if (unlimited || mode == DRV8848_MODE_STOP) {
+        state->actual = state->target;
+        state->ramp = state->target << DRV8848_SLEW_FRAC_SHIFT;
+    }
+}
+
+static void drv8848_set_targets(drv8848_mode_enum left_mode,
+                                uint16_t left_duty_cycle,
+                                drv8848_mode_enum right_mode,
+                                uint16_t right_duty_cycle, bool unlimited) {
+    ASSERT((left_duty_cycle <= PWM_DUTY_MAX));
+    ASSERT((right_duty_cycle <= PWM_DUTY_MAX));
+    CRITICAL_SECTION_BEGIN();
+    brake_periods = 0;
+    drv8848_set_target(MOTORS_LEFT, left_mode, left_duty_cycle, unlimited);
+    drv8848_set_target(MOTORS_RIGHT, right_mode, right_duty_cycle, unlimited);
+    // Apply right away what doesn't need ramping, the rest is ramped by the
+    // period ISR
+    drv8848_apply();
+    CRITICAL_SECTION_END();
+}
+
+/**
+ * Set the mode of the motor driver
+ * Mode depends on state of PWM inputs, duty cycle is in permille
+ */
+void drv8848_set_mode(motor_side_enum side, drv8848_mode_enum mode,
+                      uint16_t duty_cycle) {
+    ASSERT((duty_cycle <= PWM_DUTY_MAX));
+    CRITICAL_SECTION_BEGIN();
+    brake_periods = 0;
+    drv8848_set_target(side, mode, duty_cycle, false);
+    drv8848_apply();
+    CRITICAL_SECTION_END();
+}
+
+/**
+ * Set the mode of both motor drivers at once, all inputs are committed
+ * together in the same PWM period
+ */
+void drv8848_set_modes(drv8848_mode_enum left_mode, uint16_t left_duty_cycle,
+                       drv8848_mode_enum right_mode,
+                       uint16_t right_duty_cycle) {
+    drv8848_set_targets(left_mode, left_duty_cycle, right_mode,
+                        right_duty_cycle, false);
+}
+
+/**
+ * Same as drv8848_set_modes, but bypasses the slew limiter (e.g. to escape
+ * the line as fast as possible)
+ */
+void drv8848_set_modes_unlimited(drv8848_mode_enum left_mode,
+                                 uint16_t left_duty_cycle,
+                                 drv8848_mode_enum right_mode,
+                                 uint16_t right_duty_cycle) {
+    drv8848_set_targets(left_mode, left_duty_cycle, right_mode,
+                        right_duty_cycle, true);
+}
+
+/**
+ * Brake both motors (both inputs high) for the given time and coast
+ * afterwards. A new mode set before the time is up cancels the pulse. Braking
+ * the whole way to standstill can bounce the robot back, so a pulse long
+ * enough to kill most of the speed followed by coasting stops it the fastest.
+ */
+void drv8848_brake(uint16_t duration_ms) {
+    ASSERT(duration_ms > 0);
+    ASSERT((duration_ms <= UINT16_MAX / PWM_PERIODS_PER_MS));
+    CRITICAL_SECTION_BEGIN();
+    drv8848_set_target(MOTORS_LEFT, DRV8848_MODE_STOP, 0, true);
+    drv8848_set_target(MOTORS_RIGHT, DRV8848_MODE_STOP, 0, true);
+    drv8848_apply();
+    brake_periods = duration_ms * PWM_PERIODS_PER_MS;
+    CRITICAL_SECTION_END();
+}
+
+/**
+ * Set the calibration of one motor and direction, takes effect with the next
+ * command
+ */
+void drv8848_set_calibration(motor_side_enum side, drv8848_dir_enum dir,
+                             const struct drv8848_calibration *calibration) {
+    ASSERT((calibration->deadband < calibration->max));
+    ASSERT((calibration->max <= PWM_DUTY_MAX));
+    const uint16_t range = calibration->max - calibration->deadband;
+    CRITICAL_SECTION_BEGIN();
+    calibrations[side][dir] = *calibration;
+    for (uint8_t i = 0; i < DRV8848_CAL_POINT_CNT; i++) {
+        // The last point is extrapolated past PWM_DUTY_MAX, so the last
+        // segment is as wide as the others
+        const uint32_t command = (uint32_t)i << DRV8848_CAL_SEGMENT_SHIFT;
+        calibration_lut[side][dir][i] =
+            calibration->deadband +
+            (uint16_t)((command * range + PWM_DUTY_MAX / 2U) / PWM_DUTY_MAX);
+    }
+    CRITICAL_SECTION_END();
+}
+
+void drv8848_get_calibration(motor_side_enum side, drv8848_dir_enum dir,
+                             struct drv8848_calibration *calibration) {
+    *calibration = calibrations[side][dir];
+}
+
+/**
+ * Set the slew rates in permille per millisecond, DRV8848_SLEW_UNLIMITED
+ * disables the limit
+ */
+void drv8848_set_slew_rate(uint16_t accel, uint16_t decel) {
+    ASSERT((accel <= PWM_DUTY_MAX && decel <= PWM_DUTY_MAX));
+    const uint16_t accel_step = DRV8848_SLEW_STEP(accel);
+    const uint16_t decel_step = DRV8848_SLEW_STEP(decel);
+    CRITICAL_SECTION_BEGIN();
+    slew_accel_step = accel_step;
+    slew_decel_step = decel_step;
+    CRITICAL_SECTION_END();
 }
 
 /**
@@ -128,39 +549,46 @@ static_assert(DRV8848_LEFT1 == (int)PWM_DRV8848_LEFT1,
               "PWM and DRV LEFT1 enum mismatch");
 static_assert(DRV8848_LEFT2 == (int)PWM_DRV8848_LEFT2,
               "PWM and DRV LEFT2 enum mismatch");
-void drv8848_set_pwm(drv8848_enum device, uint8_t duty_cycle) {
-    pwm_set_duty_cycle((mdrv_enum)device, duty_cycle);
+static_assert(DRV8848_CNT == (int)PWM_DRV8848_CNT,
+              "PWM and DRV count mismatch");
+void drv8848_set_pwm(drv8848_enum device, uint16_t duty_cycle) {
+    duty_cycles[device] = duty_cycle;
+    if (!fault_active) { // Otherwise applied once the drivers are re-enabled
+        pwm_set_duty_cycle((mdrv_enum)device, duty_cycle);
+    }
 }
 
 /**
- * Enable or disable both motor drivers
+ * Enable or disable both motor drivers. While a fault is being backed off the
+ * drivers stay asleep, and are enabled when the backoff has elapsed.
  */
 void drv8848_enable(bool enable) {
-    // Enable both motors
-    if (enable)
-        io_set_out(MOTOR_ENABLE, IO_OUT_HIGH);
-    else // Disable both motors
+    enabled = enable;
+    if (!enable) { // Disable both motors
         io_set_out(MOTOR_ENABLE, IO_OUT_LOW);
+    } else if (!fault_active) { // Enable both motors
+        io_set_out(MOTOR_ENABLE, IO_OUT_HIGH);
+        wait_periods = DRV8848_WAKE_PERIODS;
+    }
 }
 
 /**
- * Check nfault pin value of motor driver
- * IO config compare for nFAULT already handled in drv8848_init()
+ * True while the drivers are asleep because of a fault
  */
-void drv8848_check_nfault(motor_side_enum side) {
-    // Right Side motor = 0
-    // Left side motor = 1
-    io_signal_enum nfault_pin = side ? MOTOR_LEFT_NFAULT : MOTOR_RIGHT_NFAULT;
-    bool nfault_stat = io_read_input(nfault_pin); // Read nfault pin
-    if (!nfault_stat) {
-        TRACE("nFAULT = 0");
-        drv8848_enable(false); // Disable both motor drivers
-        // Turn off PWM inputs to both motors
-        drv8848_set_pwm(DRV8848_RIGHT1, 0);
-        drv8848_set_pwm(DRV8848_RIGHT2, 0);
-        drv8848_set_pwm(DRV8848_LEFT1, 0);
-        drv8848_set_pwm(DRV8848_LEFT2, 0);
-    } else {
-        TRACE("nFAULT = 1");
+bool drv8848_is_faulted(void) { return fault_active; }
+
+/**
+ * Get the oldest queued fault event, returns false if there is none
+ */
+bool drv8848_get_fault_event(struct drv8848_fault_event *event) {
+    bool available = false;
+    __disable_interrupt();
+    if (!ring_buffer_isempty(fault_events)) {
+        const uint8_t raw = ring_buffer_pop(fault_events);
+        event->faults = raw & DRV8848_FAULT_MASK;
+        event->consecutive_cnt = raw >> DRV8848_FAULT_EVENT_CNT_OFFSET;
+        available = true;
     }
+    __enable_interrupt();
+    return available;
 }
@@ -1,25 +1,75 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-typedef enum { MOTORS_RIGHT, MOTORS_LEFT } motor_side_enum;
+typedef enum { MOTORS_RIGHT, MOTORS_LEFT, MOTORS_SIDE_CNT } motor_side_enum;
 
 typedef enum {
     DRV8848_RIGHT1,
     DRV8848_RIGHT2,
     DRV8848_LEFT1,
-    DRV8848_LEFT2
+    DRV8848_LEFT2,
+    DRV8848_CNT
 } drv8848_enum;
 
 typedef enum {
     DRV8848_MODE_COAST,
     DRV8848_MODE_FORWARD,
     DRV8848_MODE_REVERSE,
-    DRV8848_MODE_STOP
+    DRV8848_MODE_STOP,
+    DRV8848_MODE_FORWARD_SLOW_DECAY,
+    DRV8848_MODE_REVERSE_SLOW_DECAY
 } drv8848_mode_enum;
 
+typedef enum {
+    DRV8848_DIR_FORWARD,
+    DRV8848_DIR_REVERSE,
+    DRV8848_DIR_CNT
+} drv8848_dir_enum;
+
+/**
+ * Calibration of one motor in one direction, in permille duty cycle
+ * deadband: Smallest duty cycle that gets the motor turning (any non-zero
+ *           command is raised to at least this)
+ * max: Duty cycle applied for a full command, lower it on the faster motor to
+ *      match the slower one (trim)
+ */
+struct drv8848_calibration {
+    uint16_t deadband;
+    uint16_t max;
+};
+
+// nFAULT of each side, bits of drv8848_fault_event.faults
+#define DRV8848_FAULT_RIGHT (1U << MOTORS_RIGHT)
+#define DRV8848_FAULT_LEFT (1U << MOTORS_LEFT)
+#define DRV8848_FAULT_MASK (DRV8848_FAULT_RIGHT | DRV8848_FAULT_LEFT)
+#define DRV8848_FAULT_EVENT_CNT_OFFSET (2U)
+#define DRV8848_FAULT_CNT_MAX (UINT8_MAX >> DRV8848_FAULT_EVENT_CNT_OFFSET)
+
+// Slew rate in permille per millisecond, 0 means no limit
+#define DRV8848_SLEW_UNLIMITED (0U)
+
+struct drv8848_fault_event {
+    uint8_t faults;          // DRV8848_FAULT_RIGHT/LEFT
+    uint8_t consecutive_cnt; // Faults since the drivers last ran without one
+};
+
 void drv8848_init(void);
 void drv8848_set_mode(motor_side_enum side, drv8848_mode_enum mode,
-                      uint8_t duty_cycle);
-void drv8848_set_pwm(drv8848_enum device, uint8_t duty_cycle);
+                      uint16_t duty_cycle);
+void drv8848_set_modes(drv8848_mode_enum left_mode, uint16_t left_duty_cycle,
+                       drv8848_mode_enum right_mode,
+                       uint16_t right_duty_cycle);
+void drv8848_set_modes_unlimited(drv8848_mode_enum left_mode,
+                                 uint16_t left_duty_cycle,
+                                 drv8848_mode_enum right_mode,
+                                 uint16_t right_duty_cycle);
+void drv8848_set_slew_rate(uint16_t accel, uint16_t decel);
+void drv8848_brake(uint16_t duration_ms);
+void drv8848_set_calibration(motor_side_enum side, drv8848_dir_enum dir,
+                             const struct drv8848_calibration *calibration);
+void drv8848_get_calibration(motor_side_enum side, drv8848_dir_enum dir,
+                             struct drv8848_calibration *calibration);
+void drv8848_set_pwm(drv8848_enum device, uint16_t duty_cycle);
 void drv8848_enable(bool enable);
-void drv8848_check_nfault(motor_side_enum side);
+bool drv8848_is_faulted(void);
+bool drv8848_get_fault_event(struct drv8848_fault_event *event);
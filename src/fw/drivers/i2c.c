@@ -1,15 +1,26 @@
 #include "drivers/i2c.h"
 #include "common/assert_handler.h"
+#include "common/timer_wheel.h"
 #include "common/trace.h"
 #include "drivers/io.h"
 #include <msp430.h>
 #include <stdbool.h>
 #include <stdint.h>
 
-#define RETRY_COUNT                                                            \
-    (UINT16_MAX) // Needs to be large enough to give hardware time to actually
-                 // set registers (uint8_t max == 255, not long enough)
+// A byte takes ~0.1 ms at 100 kHz, a wait longer than this means the bus or
+// the slave is stuck
+#define I2C_TIMEOUT_MS (3U)
 static bool initialized = false;
+static struct timer_wheel_timer timeout_timer;
+static volatile bool timed_out = false;
+
+// Runs in the system tick ISR
+static void i2c_timeout(void) { timed_out = true; }
+
+static inline void i2c_start_timeout(void) {
+    timed_out = false;
+    timer_wheel_start(&timeout_timer, I2C_TIMEOUT_MS);
+}
 
 static inline void i2c_set_tx_byte(uint8_t data) {
     UCB1TXBUF = data; // Set the data to be transmitted
@@ -18,18 +29,18 @@ static inline void i2c_set_tx_byte(uint8_t data) {
 static uint8_t i2c_get_rx_byte() { return UCB1RXBUF; }
 
 static e__i2c_result i2c_stop_transfer() {
-    uint16_t retries = RETRY_COUNT;
+    i2c_start_timeout();
     // Send stop condition
     UCB1CTL1 |= UCTXSTP;
     // UCTXSTP bit in UCB1CTL1 is automatically cleared after stop condition is
     // generated
     while (UCB1CTL1 & UCTXSTP) {
-        retries--;
-        if (retries == 0) {
+        if (timed_out) {
             TRACE("I2C stop condition timeout");
             return I2C_RESULT_ERROR_TIMEOUT;
         }
     }
+    timer_wheel_cancel(&timeout_timer);
     return I2C_RESULT_OK;
 }
 
@@ -40,16 +51,16 @@ static inline void i2c_send_start_condition(void) {
 }
 
 static e__i2c_result i2c_wait_for_start_condition(void) {
-    uint16_t retries = RETRY_COUNT;
+    i2c_start_timeout();
     // UCTXSTT is automatically cleared after START condition and address
     // information is transmitted
     while (UCB1CTL1 & UCTXSTT) {
-        retries--;
-        if (retries == 0) {
+        if (timed_out) {
             TRACE("I2C start condition timeout");
             return I2C_RESULT_ERROR_TIMEOUT;
         }
     }
+    timer_wheel_cancel(&timeout_timer);
     // If receive NACK from slave, return error, otherwise ok
     return (UCB1IFG & UCNACKIFG) ? I2C_RESULT_ERROR_START : I2C_RESULT_OK;
 }
@@ -61,15 +72,15 @@ static e__i2c_result i2c_wait_for_start_condition(void) {
  * return ok.
  */
 static e__i2c_result i2c_wait_for_tx_byte(void) {
-    uint16_t retries = RETRY_COUNT;
+    i2c_start_timeout();
     // USCI transmit interrupt flag. UCTXIFG is set when UCBxTXBUF is empty
     while (!(UCB1IFG & UCTXIFG)) {
-        retries--;
-        if (retries == 0) {
+        if (timed_out) {
             TRACE("I2C TX send timeout");
             return I2C_RESULT_ERROR_TIMEOUT;
         }
     }
+    timer_wheel_cancel(&timeout_timer);
     // If receive NACK from slave, return error, otherwise ok
     return (UCB1IFG & UCNACKIFG) ? I2C_RESULT_ERROR_TX : I2C_RESULT_OK;
 }
@@ -81,15 +92,15 @@ static e__i2c_result i2c_wait_for_tx_byte(void) {
  * return ok.
  */
 static e__i2c_result i2c_wait_for_rx_byte(void) {
-    uint16_t retries = RETRY_COUNT;
+    i2c_start_timeout();
     // USCI transmit interrupt flag. UCRXIFG is set when UCBxRXBUF is empty
     while (!(UCB1IFG & UCRXIFG)) {
-        retries--;
-        if (retries == 0) {
+        if (timed_out) {
             TRACE("I2C RX receive timeout");
             return I2C_RESULT_ERROR_TIMEOUT;
         }
     }
+    timer_wheel_cancel(&timeout_timer);
     // If receive NACK from slave, return error, otherwise ok
     return (UCB1IFG & UCNACKIFG) ? I2C_RESULT_ERROR_RX : I2C_RESULT_OK;
 }
@@ -147,6 +158,7 @@ static e__i2c_result i2c_start_rx_transfer(const uint8_t *addr,
  */
 void i2c_init(void) {
     ASSERT(!initialized);
+    timer_wheel_init_timer(&timeout_timer, i2c_timeout, TIMER_WHEEL_ISR);
     static const struct io_config i2c_config = {.io_sel = IO_SEL_ALT1,
                                                 .io_dir = IO_DIR_OUTPUT,
                                                 .io_ren = IO_REN_ENABLE,
@@ -1,7 +1,8 @@
 #include "drivers/io.h"
 #include "common/assert_handler.h"
 #include "common/defines.h"
-#include "common/trace.h"
+#include "common/event.h"
+#include "common/prof.h"
 #include <assert.h>
 #include <msp430.h>
 #include <stddef.h>
@@ -9,9 +10,6 @@
 
 #define IO_PORT_CNT (8U)           // Number of ports in MSP430F5529
 #define IO_PINS_PER_PORT_CNT (8U)  // Number of pins per port in MSP430F5529
-#define IO_PORT_OFFSET (3U)        // Port number = bits 3-5
-#define IO_PORT_MASK (7U)          // 3'b111
-#define IO_PIN_MASK (7U)           // 3'b111
 #define IO_INTERRUPT_PORT_CNT (2U) // Number of interrupt ports
 // Unused IO pins set to either GPIO output, or pullup/down input
 // Decided to use pulldown input
@@ -25,11 +23,11 @@ static_assert(sizeof(io_generic_enum) == 1,
               "Unexpected size, -fshort-enums missing?");
 
 static inline uint8_t calc_io_port(io_signal_enum signal) {
-    return (signal >> IO_PORT_OFFSET) & (IO_PORT_MASK);
+    return IO_PORT_IDX(signal);
 }
 
 static inline uint8_t calc_io_pin_index(io_signal_enum signal) {
-    return signal & IO_PIN_MASK;
+    return IO_PIN_IDX(signal);
 }
 
 static inline uint8_t calc_io_pin(io_signal_enum signal) {
@@ -74,8 +72,8 @@ static isr_function isr_functions[IO_INTERRUPT_PORT_CNT][IO_PINS_PER_PORT_CNT] =
     {[IO_PORT1] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL},
      [IO_PORT2] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL}};
 
-static const io_signal_enum io_adc_pins_arr[] = {LD_FRONT_LEFT, LD_FRONT_RIGHT,
-                                                 LD_BACK_LEFT, LD_BACK_RIGHT};
+#define IO_ADC_PIN_ENTRY(pin) pin,
+static const io_signal_enum io_adc_pins_arr[] = {IO_ADC_PINS(IO_ADC_PIN_ENTRY)};
 
 typedef enum { HW_TYPE_LAUNCHPAD, HW_TYPE_SUMOBOT } hw_type_enum;
 
@@ -409,10 +407,13 @@ static void io_isr(io_signal_enum io) {
     const uint8_t pin_index = calc_io_pin_index(io);
     const uint8_t pin = calc_io_pin(io);
     if (*port_interrupt_flag_regs[port] & pin) {
+        // Only the pins that interrupted, the port ISRs check all of them
+        PROF_BEGIN(PROF_IO_ISR);
         if (isr_functions[port][pin_index]) {
             isr_functions[port][pin_index]();
         } else
             ASSERT(!isr_functions[port][pin_index])
+        PROF_END(PROF_IO_ISR);
     }
     io_clear_interrupt(io); // Clear interrupt flag performing ISR action
 }
@@ -426,7 +427,6 @@ bool io_read_input(io_signal_enum io) {
     uint8_t pin = calc_io_pin(io);
     uint8_t pin_idx = calc_io_pin_index(io);
 
-    TRACE("Reading input pin P%d.%d...", port, pin);
     return ((*port_in_regs[port] & pin) >> pin_idx) ? true : false;
 }
 
@@ -440,21 +440,25 @@ const io_signal_enum *get_io_adc_pins(uint8_t *cnt) {
 }
 
 /**
- * Returns the index of the adc IO pin
+ * Returns the ADC input channel (ADC12INCHx) of the adc IO pin
  */
 uint8_t io_to_adc_idx(io_signal_enum io) {
-    ASSERT((calc_io_port(io) == IO_PORT6) || (calc_io_port(io) == IO_PORT7));
-    return calc_io_pin_index(io);
+    ASSERT(IO_ADC_IS_ANALOG_PIN(io));
+    return IO_ADC_INPUT_CHANNEL(io);
 }
 
-INTERRUPT_FUNCTION(PORT1_VECTOR) isr_port_1(void) {
+PROF_INTERRUPT_FUNCTION(PORT1_VECTOR, isr_port_1, PROF_ISR_PORT_1,
+                        PROF_LATENCY_UNKNOWN) {
     for (io_generic_enum io = IO_10; io <= IO_17; io++) {
         io_isr(io);
     }
+    EVENT_WAKE_ON_EXIT_IF_PENDING();
 }
 
-INTERRUPT_FUNCTION(PORT2_VECTOR) isr_port_2(void) {
+PROF_INTERRUPT_FUNCTION(PORT2_VECTOR, isr_port_2, PROF_ISR_PORT_2,
+                        PROF_LATENCY_UNKNOWN) {
     for (io_generic_enum io = IO_20; io <= IO_27; io++) {
         io_isr(io);
     }
+    EVENT_WAKE_ON_EXIT_IF_PENDING();
 }
@@ -1,3 +1,5 @@
+#ifndef IO_H
+#define IO_H
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -5,6 +7,27 @@
  * This wraps the register defines provided in the headers from Texas
  * Instruments */
 
+#define IO_PORT_OFFSET (3U) // Port number = bits 3-5
+#define IO_PORT_MASK (7U)   // 3'b111
+#define IO_PIN_MASK (7U)    // 3'b111
+
+// Port (0 = P1) and pin index of an io_signal_enum, usable at compile time
+#define IO_PORT_IDX(io) (((io) >> IO_PORT_OFFSET) & IO_PORT_MASK)
+#define IO_PIN_IDX(io) ((io)&IO_PIN_MASK)
+#define IO_PIN_BIT(io) (1U << IO_PIN_IDX(io))
+
+/* Port registers are laid out in pairs 0x20 apart (P1/P2 at PAIN, P3/P4 at
+ * PBIN...) with the odd port at the odd address, and PxOUT right after PxIN.
+ * For a pin known at compile time this resolves to a fixed address, so the pin
+ * can be read or written with a single instruction, e.g. from an ISR. Requires
+ * msp430.h. */
+#define IO_PORT_REG_OFFSET(io)                                                 \
+    ((IO_PORT_IDX(io) >> 1) * 0x20U + (IO_PORT_IDX(io) & 1U))
+#define IO_PORT_IN_REG(io)                                                     \
+    (*(volatile uint8_t *)((uintptr_t)&P1IN + IO_PORT_REG_OFFSET(io)))
+#define IO_PORT_OUT_REG(io)                                                    \
+    (*(volatile uint8_t *)((uintptr_t)&P1OUT + IO_PORT_REG_OFFSET(io)))
+
 typedef enum {
 // IO_xx -> (Port, Pin bit position)
 #ifdef LAUNCHPAD
@@ -359,6 +382,21 @@ typedef enum {
 #endif
 } io_signal_enum;
 
+/* Pins sampled by the ADC, in the order they are sampled. This is the only
+ * place to edit when adding an analog input, the ADC sequence, DMA size and
+ * channel count are all generated from it. */
+#define IO_ADC_PINS(X)                                                         \
+    X(LD_FRONT_LEFT)                                                           \
+    X(LD_FRONT_RIGHT)                                                          \
+    X(LD_BACK_LEFT)                                                            \
+    X(LD_BACK_RIGHT)
+
+// Analog inputs are P6.0-P6.7 (A0-A7) and P7.0-P7.3 (A12-A15)
+#define IO_ADC_IS_ANALOG_PIN(io)                                               \
+    (IO_PORT_IDX(io) == 5U || (IO_PORT_IDX(io) == 6U && IO_PIN_IDX(io) < 4U))
+#define IO_ADC_INPUT_CHANNEL(io)                                               \
+    (IO_PORT_IDX(io) == 5U ? IO_PIN_IDX(io) : 12U + IO_PIN_IDX(io))
+
 typedef enum { IO_TRIGGER_RISING, IO_TRIGGER_FALLING } io_trigger_enum;
 
 void io_set_sel(io_signal_enum pin, io_sel_enum select);
@@ -380,3 +418,5 @@ void io_disable_interrupt(io_signal_enum pin);
 bool io_read_input(io_signal_enum pin);
 const io_signal_enum *get_io_adc_pins(uint8_t *cnt);
 uint8_t io_to_adc_idx(io_signal_enum pin);
+
+#endif // IO_H
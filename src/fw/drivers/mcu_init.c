@@ -1,5 +1,10 @@
 #include "common/assert_handler.h"
+#include "common/prof.h"
+#include "common/stack.h"
+#include "common/timer_wheel.h"
+#include "drivers/debug_marker.h"
 #include "drivers/io.h"
+#include "drivers/systick.h"
 #include <msp430.h>
 
 static void init_clocks() {
@@ -66,7 +71,12 @@ void mcu_init(void) {
         WDTHOLD; // stop watchdog timer, otherwise it prevents program from
                  // running because it keeps restarting from watchdog timeout
     init_clocks();
+    stack_paint();
     io_init();
+    debug_marker_init();
+    systick_init();
+    prof_init();
+    timer_wheel_init();
     // Enable interrupts globally
     __enable_interrupt(); // Call function from TI
 }
@@ -1,17 +1,28 @@
 #include "drivers/pwm.h"
 #include "common/assert_handler.h"
 #include "common/defines.h"
+#include "common/prof.h"
 #include "common/trace.h"
+#include "drivers/debug_marker.h"
 #include "drivers/io.h"
 #include <assert.h>
 #include <msp430.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define PWM_TIMER_FREQ_HZ (SMCLK / TIMER_INPUT_DIVIER_3)
-#define PWM_PERIOD_FREQ_HZ (20000U)
+/**
+ * The timer runs undivided from SMCLK so that a period at an inaudible PWM
+ * frequency still has enough ticks for a fine grained duty cycle. Change
+ * PWM_PERIOD_FREQ_HZ to trade resolution for frequency, the duty cycle table
+ * below is derived from the ticks per period.
+ */
+#define PWM_TIMER_FREQ_HZ (SMCLK / TIMER_INPUT_DIVIER_0)
 #define PWM_PERIOD_TICKS (PWM_TIMER_FREQ_HZ / PWM_PERIOD_FREQ_HZ)
-static_assert(PWM_PERIOD_TICKS == 100, "Expect 100 ticks per period");
+static_assert(PWM_TIMER_FREQ_HZ % PWM_PERIOD_FREQ_HZ == 0,
+              "PWM frequency must divide the timer frequency");
+static_assert(PWM_PERIOD_FREQ_HZ % 1000U == 0,
+              "PWM frequency must be whole periods per ms");
 
 #define PWM_TAxCCR0                                                            \
     (PWM_PERIOD_TICKS - 1) // Subtract 1 because timer counts from 0
@@ -21,22 +32,102 @@ static const struct io_config pwm_io_config = {.io_sel = IO_SEL_ALT2,
                                                .io_ren = IO_REN_DISABLE,
                                                .io_out = IO_OUT_LOW};
 
+/**
+ * Battery is at ~8V and motor supplies are rated for 6V, so scale down the
+ * applied duty cycle by 25% so that average voltage will be ~6V max.
+ * NOTE: Drop the scaling if able to get 12V rated motors.
+ */
+#define PWM_SCALED_MAX_TICKS (PWM_PERIOD_TICKS * 3U / 4U)
+
+/**
+ * Duty cycle (permille) to compare ticks, rounded up so that a non-zero duty
+ * cycle never ends up as 0 ticks (the same as if PWM is disabled). The table
+ * is expanded by the preprocessor, so a duty cycle update is a lookup and a
+ * register store instead of a multiply and divide.
+ */
+#define PWM_DUTY_TICKS(duty)                                                   \
+    (uint16_t)(((duty)*PWM_SCALED_MAX_TICKS + PWM_DUTY_MAX - 1U) / PWM_DUTY_MAX)
+#define PWM_DUTY_TICKS_1(d) PWM_DUTY_TICKS(d),
+#define PWM_DUTY_TICKS_10(d)                                                   \
+    PWM_DUTY_TICKS_1(d) PWM_DUTY_TICKS_1(d + 1) PWM_DUTY_TICKS_1(d + 2)        \
+        PWM_DUTY_TICKS_1(d + 3) PWM_DUTY_TICKS_1(d + 4)                        \
+            PWM_DUTY_TICKS_1(d + 5) PWM_DUTY_TICKS_1(d + 6)                    \
+                PWM_DUTY_TICKS_1(d + 7) PWM_DUTY_TICKS_1(d + 8)                \
+                    PWM_DUTY_TICKS_1(d + 9)
+#define PWM_DUTY_TICKS_100(d)                                                  \
+    PWM_DUTY_TICKS_10(d) PWM_DUTY_TICKS_10(d + 10) PWM_DUTY_TICKS_10(d + 20)   \
+        PWM_DUTY_TICKS_10(d + 30) PWM_DUTY_TICKS_10(d + 40)                    \
+            PWM_DUTY_TICKS_10(d + 50) PWM_DUTY_TICKS_10(d + 60)                \
+                PWM_DUTY_TICKS_10(d + 70) PWM_DUTY_TICKS_10(d + 80)            \
+                    PWM_DUTY_TICKS_10(d + 90)
+#define PWM_DUTY_TICKS_1000(d)                                                 \
+    PWM_DUTY_TICKS_100(d) PWM_DUTY_TICKS_100(d + 100)                          \
+        PWM_DUTY_TICKS_100(d + 200) PWM_DUTY_TICKS_100(d + 300)                \
+            PWM_DUTY_TICKS_100(d + 400) PWM_DUTY_TICKS_100(d + 500)            \
+                PWM_DUTY_TICKS_100(d + 600) PWM_DUTY_TICKS_100(d + 700)        \
+                    PWM_DUTY_TICKS_100(d + 800) PWM_DUTY_TICKS_100(d + 900)
+
+static const uint16_t pwm_duty_ticks[PWM_DUTY_MAX + 1] = {
+    PWM_DUTY_TICKS_1000(0UL) PWM_DUTY_TICKS(PWM_DUTY_MAX)};
+static_assert(PWM_DUTY_MAX == 1000U, "Table above expects 1000 steps");
+
 struct pwm_channel_cfg {
-    bool enable;
     volatile unsigned int *const cctl;
     volatile unsigned int *const ccr;
+    volatile unsigned int *const tar;
 };
 
-static struct pwm_channel_cfg pwm_cfgs[] = {
-    [PWM_DRV8848_RIGHT1] = {.enable = false,
-                            .cctl = &TA2CCTL2,
-                            .ccr = &TA2CCR2},
-    [PWM_DRV8848_RIGHT2] = {.enable = false,
-                            .cctl = &TA2CCTL1,
-                            .ccr = &TA2CCR1},
-    [PWM_DRV8848_LEFT1] = {.enable = false, .cctl = &TA0CCTL4, .ccr = &TA0CCR4},
-    [PWM_DRV8848_LEFT2] = {
-        .enable = false, .cctl = &TA0CCTL3, .ccr = &TA0CCR3}};
+static const struct pwm_channel_cfg pwm_cfgs[PWM_DRV8848_CNT] = {
+    [PWM_DRV8848_RIGHT1] = {.cctl = &TA2CCTL2, .ccr = &TA2CCR2, .tar = &TA2R},
+    [PWM_DRV8848_RIGHT2] = {.cctl = &TA2CCTL1, .ccr = &TA2CCR1, .tar = &TA2R},
+    [PWM_DRV8848_LEFT1] = {.cctl = &TA0CCTL4, .ccr = &TA0CCR4, .tar = &TA0R},
+    [PWM_DRV8848_LEFT2] = {.cctl = &TA0CCTL3, .ccr = &TA0CCR3, .tar = &TA0R}};
+
+/**
+ * Strategy:
+ * Duty cycles are staged in RAM and committed for all channels at once from
+ * the TA0 CCR0 interrupt, which fires at the end of every period, so all four
+ * channels switch at the same period boundary. TA0 and TA2 are started
+ * together and never halted or cleared afterwards, so both motors share the
+ * same period.
+ *
+ * Timer_A has no compare latch, a compare value or output mode applies as
+ * soon as it is written. Each channel starts the period at one level and
+ * switches to the other at its compare value (or never, for a constant
+ * output). A write just after the period boundary would skip that switch if
+ * the new compare value has already gone by while the old one hasn't, and
+ * the output would then stay at its start level for the whole period. Such a
+ * channel is instead written from its own compare interrupt, once its output
+ * has switched, and applies from the next period on.
+ */
+// Compare ticks (0 = disabled) OR'ed with PWM_DUTY_INVERTED
+static volatile uint16_t staged_ticks[PWM_DRV8848_CNT];
+static volatile uint8_t pending = 0; // Bit per channel with a staged change
+static_assert(PWM_PERIOD_TICKS < PWM_DUTY_INVERTED,
+              "Ticks overlap with the inverted flag");
+static_assert(PWM_DRV8848_CNT <= 8U, "Pending bits don't fit uint8_t");
+static pwm_period_cb period_cb = NULL;
+
+/**
+ * TAxCCTLn
+ * OUTMOD_7: Reset/Set (output is high from TAxCCR0 until TAxCCRn)
+ * OUTMOD_3: Set/Reset (output is low from TAxCCR0 until TAxCCRn)
+ * OUTMOD_0: Output follows the OUT bit (0 = low), i.e. channel is disabled
+ * OUTMOD_3 stays set when switching between 7 and 3, so there is no glitch.
+ */
+#define PWM_CCTL_START_HIGH (OUTMOD_7)
+#define PWM_CCTL_START_LOW (OUTMOD_3)
+#define PWM_CCTL_DISABLED (OUTMOD_0)
+// Compare value the timer never counts to, the output keeps its start level
+#define PWM_CCR_NEVER (PWM_PERIOD_TICKS)
+// Timer ticks that may pass between reading the count and writing a channel
+#define PWM_WRITE_MARGIN_TICKS (64U)
+
+static inline uint16_t pwm_duty_to_ticks(uint16_t duty_cycle) {
+    const uint16_t duty = duty_cycle & ~PWM_DUTY_INVERTED;
+    ASSERT((duty <= PWM_DUTY_MAX));
+    return pwm_duty_ticks[duty] | (duty_cycle & PWM_DUTY_INVERTED);
+}
 
 /**
  * Initialize PWM timer registers
@@ -66,81 +157,225 @@ void pwm_init(void) {
     /**
      * TAxCTL0: [Reserved (15-10), TASSEL (9-8), ID (7-6), MC (5-4), Reserved
      * (3), TACLR (2), TAIE (1), TAIFG (0)] TASSEL = 2 (Clock source SMCLK) ID =
-     * 3 (Divide clock source by 8) MC = 0 (Timer Mode: Halted)
+     * 0 (Don't divide clock source) MC = 0 (Timer Mode: Halted) TACLR = 1
+     * (Clear the counter)
      */
-    TA0CTL |= (TASSEL_2 | ID_3 | MC_0);
-    TA2CTL |= (TASSEL_2 | ID_3 | MC_0);
+    TA0CTL = TASSEL_2 | ID_0 | MC_0 | TACLR;
+    TA2CTL = TASSEL_2 | ID_0 | MC_0 | TACLR;
     TA0CCR0 = PWM_TAxCCR0;
     TA2CCR0 = PWM_TAxCCR0;
+    for (uint8_t ch = 0; ch < ARRAY_SIZE(pwm_cfgs); ch++) {
+        *pwm_cfgs[ch].cctl = PWM_CCTL_DISABLED;
+        *pwm_cfgs[ch].ccr = PWM_CCR_NEVER;
+        *pwm_cfgs[ch].cctl = PWM_CCTL_START_LOW;
+    }
+
+    /**
+     * MC_1: Up mode (Count up to TAxCCR0)
+     * Start TA2 right before TA0, so TA2 is a few cycles ahead and has always
+     * wrapped around by the time the TA0 CCR0 ISR writes the next values.
+     */
+    TA2CTL |= MC_1;
+    TA0CTL |= MC_1;
     initialized = true;
 }
 
+static inline uint16_t pwm_ticks_to_ccr(uint16_t ticks) {
+    const uint16_t compare = ticks & ~PWM_DUTY_INVERTED;
+    return compare ? compare : PWM_CCR_NEVER;
+}
+
 /**
- * Checks if all pwm channels (motor drive inputs) are disabled
+ * A duty cycle of 0 keeps the output at its start level, low (or high if
+ * inverted)
  */
-static bool pwm_ch_all_disabled() {
-    for (uint8_t ch = 0; ch < ARRAY_SIZE(pwm_cfgs); ch++) {
-        if (pwm_cfgs[ch].enable)
+static inline uint16_t pwm_ticks_to_cctl(uint16_t ticks) {
+    const bool has_compare = ticks & ~PWM_DUTY_INVERTED;
+    const bool inverted = ticks & PWM_DUTY_INVERTED;
+    return has_compare != inverted ? PWM_CCTL_START_HIGH : PWM_CCTL_START_LOW;
+}
+
+/**
+ * Write the staged duty cycle of a channel unless that would skip or add a
+ * switch of its output in the current period. Returns false if it has to be
+ * tried again from the compare interrupt, once the output has switched.
+ */
+static bool pwm_commit_channel(uint8_t ch) {
+    const struct pwm_channel_cfg *cfg = &pwm_cfgs[ch];
+    const uint16_t ticks = staged_ticks[ch];
+    const uint16_t ccr = pwm_ticks_to_ccr(ticks);
+    const uint16_t outmod = pwm_ticks_to_cctl(ticks);
+    const uint16_t old_ccr = *cfg->ccr;
+    const uint16_t old_outmod = *cfg->cctl & OUTMOD_7;
+    if (ccr == old_ccr && outmod == old_outmod) {
+        return true;
+    }
+    // A constant output has no switch to skip, it can be written any time
+    if (old_ccr != PWM_CCR_NEVER) {
+        const uint16_t now = *cfg->tar;
+        if (now >= PWM_PERIOD_TICKS - PWM_WRITE_MARGIN_TICKS) {
+            return false; // The output may be back at its start level
+        }
+        if (now < old_ccr) {
+            // Still at the start level, only a new compare value of the same
+            // mode that is still ahead switches it in this period
+            if (outmod != old_outmod ||
+                old_ccr <= now + PWM_WRITE_MARGIN_TICKS ||
+                ccr <= now + PWM_WRITE_MARGIN_TICKS) {
+                return false;
+            }
+        } else if (outmod != old_outmod && ccr > now && ccr != PWM_CCR_NEVER) {
+            // Switched, but the new mode would switch back at the new compare
+            // value. Move the compare value first (the old mode switches to
+            // the level the output is already at), and change the mode from
+            // its compare interrupt.
+            *cfg->ccr = ccr;
             return false;
+        }
     }
+    *cfg->ccr = ccr;
+    *cfg->cctl = (*cfg->cctl & ~OUTMOD_7) | outmod;
     return true;
 }
 
 /**
- * Resets timer and sets timer to count up mode
+ * Mark the channels in mask as changed, they are committed at the end of the
+ * current period
  */
-static void pwm_enable(bool enable) {
-    /**
-     * MC_0: Timer is halted
-     * MC_1: Up mode (Count up to TAxCCR0)
-     */
-    TA0CTL |= (enable ? MC_1 : MC_0) + TACLR;
-    TA2CTL |= (enable ? MC_1 : MC_0) + TACLR;
+static void pwm_stage(uint8_t mask) {
+    pending |= mask;
+    if (!(TA0CCTL0 & CCIE)) {
+        // CCIFG is set every period, clear it so the ISR only fires (and
+        // commits) at the end of the current period instead of right away
+        TA0CCTL0 = CCIE;
+    }
+}
+
+/**
+ * Set duty cycle (permille, optionally OR'ed with PWM_DUTY_INVERTED) of PWM
+ * for specified motor driver. The new duty cycle is applied at the end of the
+ * current period.
+ */
+void pwm_set_duty_cycle(mdrv_enum mdrv, uint16_t duty_cycle) {
+    ASSERT(initialized);
+    const uint16_t ticks = pwm_duty_to_ticks(duty_cycle);
+    CRITICAL_SECTION_BEGIN();
+    staged_ticks[mdrv] = ticks;
+    pwm_stage(1U << mdrv);
+    CRITICAL_SECTION_END();
 }
 
 /**
- * Enables PWM channel that connects to motor driver
- * or disables all PWM channels if they are all off
+ * Set duty cycles (permille) of all channels at once, indexed by mdrv_enum.
+ * They are applied together at the end of the current period, channels that
+ * did not change are skipped.
  */
-static void pwm_channel_enable(mdrv_enum mdrv, bool enable) {
-    if (pwm_cfgs[mdrv].enable != enable) {
-        *pwm_cfgs[mdrv].cctl = enable ? OUTMOD_7 : OUTMOD_0;
-        pwm_cfgs[mdrv].enable = enable;
-        if (enable) {
-            pwm_enable(true);
-        } else if (pwm_ch_all_disabled()) {
-            pwm_enable(false);
+void pwm_set_duty_cycles(const uint16_t duty_cycles[PWM_DRV8848_CNT]) {
+    ASSERT(initialized);
+    uint16_t ticks[PWM_DRV8848_CNT];
+    for (uint8_t ch = 0; ch < PWM_DRV8848_CNT; ch++) {
+        ticks[ch] = pwm_duty_to_ticks(duty_cycles[ch]);
+    }
+    // The ISR never sees a partial update
+    CRITICAL_SECTION_BEGIN();
+    uint8_t changed = 0;
+    for (uint8_t ch = 0; ch < PWM_DRV8848_CNT; ch++) {
+        if (staged_ticks[ch] != ticks[ch]) {
+            staged_ticks[ch] = ticks[ch];
+            changed |= 1U << ch;
         }
     }
+    if (changed) {
+        pwm_stage(changed);
+    }
+    CRITICAL_SECTION_END();
 }
 
 /**
- *  Scale input PWM duty cycle down by 25%
- *  This will lower the average voltage from VM on the motor
- *  NOTE: Might not use this function if able to get 12V rated motors.
+ * Commit the staged duty cycles at the end of a period. Channels that can't be
+ * written yet are left to their compare interrupt. The timer wraps one tick
+ * after the trigger, so its count plus one is the latency.
  */
-static inline uint8_t pwm_scale_duty_cycle(uint8_t duty_cycle_percent) {
-    /**
-     * Battery is at ~8V and motor supplies are rated for 6V, so scale down the
-     * applied input PWM duty cycle by 25% so that average voltage will be ~6V
-     * max. This function should never return 0 because that is the same as if
-     * PWM is disabled.
-     */
-    return duty_cycle_percent == 1 ? duty_cycle_percent
-                                   : (duty_cycle_percent * 3 / 4);
+PROF_INTERRUPT_FUNCTION(TIMER0_A0_VECTOR, isr_pwm_period, PROF_ISR_PWM_PERIOD,
+                        TA0R + 1U) {
+    DEBUG_MARKER_HIGH(DEBUG_MARKER_PWM);
+    if (period_cb) {
+        period_cb();
+    } else {
+        TA0CCTL0 &= ~CCIE; // Nothing to commit until a duty cycle is changed
+    }
+    const uint8_t commit = pending;
+    pending = 0;
+    for (uint8_t ch = 0; ch < PWM_DRV8848_CNT; ch++) {
+        if ((commit & (1U << ch)) && !pwm_commit_channel(ch)) {
+            // Its flag is stale, it's set at every compare
+            *pwm_cfgs[ch].cctl = (*pwm_cfgs[ch].cctl & ~CCIFG) | CCIE;
+        }
+    }
+    DEBUG_MARKER_LOW(DEBUG_MARKER_PWM);
+}
+
+static inline void pwm_commit_deferred(uint8_t ch) {
+    if (pwm_commit_channel(ch)) {
+        *pwm_cfgs[ch].cctl &= ~CCIE;
+    }
+}
+
+// The compare value may have been moved since it triggered, so the latency is
+// unknown
+PROF_INTERRUPT_FUNCTION(TIMER0_A1_VECTOR, isr_pwm_compare_ta0,
+                        PROF_ISR_PWM_COMPARE_TA0, PROF_LATENCY_UNKNOWN) {
+    switch (__even_in_range(TA0IV, TA0IV_TA0IFG)) {
+    case TA0IV_TA0CCR3:
+        pwm_commit_deferred(PWM_DRV8848_LEFT2);
+        break;
+    case TA0IV_TA0CCR4:
+        pwm_commit_deferred(PWM_DRV8848_LEFT1);
+        break;
+    default:
+        break;
+    }
+}
+
+PROF_INTERRUPT_FUNCTION(TIMER2_A1_VECTOR, isr_pwm_compare_ta2,
+                        PROF_ISR_PWM_COMPARE_TA2, PROF_LATENCY_UNKNOWN) {
+    switch (__even_in_range(TA2IV, TA2IV_TA2IFG)) {
+    case TA2IV_TA2CCR1:
+        pwm_commit_deferred(PWM_DRV8848_RIGHT2);
+        break;
+    case TA2IV_TA2CCR2:
+        pwm_commit_deferred(PWM_DRV8848_RIGHT1);
+        break;
+    default:
+        break;
+    }
 }
 
 /**
- * Set duty cycle of PWM for specified motor driver
+ * Disable all channels right away instead of at the end of the period, and
+ * drop any staged duty cycle. Safe to call from ISR context.
  */
-void pwm_set_duty_cycle(mdrv_enum mdrv, uint8_t duty_cycle_percent) {
-    ASSERT(initialized);
-    const bool enable =
-        duty_cycle_percent > 0; // Check if given duty cycle is > 0%
-    if (enable) {               // If duty cycle is greater than 0
-        *pwm_cfgs[mdrv].ccr = pwm_scale_duty_cycle(
-            duty_cycle_percent); // Set PWM to scaled target duty cycle
+void pwm_disable_all(void) {
+    CRITICAL_SECTION_BEGIN();
+    pending = 0;
+    for (uint8_t ch = 0; ch < PWM_DRV8848_CNT; ch++) {
+        *pwm_cfgs[ch].cctl = PWM_CCTL_DISABLED; // Also no compare interrupt
+        *pwm_cfgs[ch].ccr = PWM_CCR_NEVER;
+        staged_ticks[ch] = 0;
     }
-    pwm_channel_enable(mdrv,
-                       enable); // Enable PWM output of MCU to motor driver
+    CRITICAL_SECTION_END();
+}
+
+/**
+ * Register a function to be called from the timer ISR at the end of every
+ * PWM period (PWM_PERIOD_FREQ_HZ), right before the staged duty cycles are
+ * committed. Keep it short, it runs in ISR context.
+ */
+void pwm_register_period_cb(pwm_period_cb cb) {
+    ASSERT(initialized);
+    ASSERT(!period_cb);
+    CRITICAL_SECTION_BEGIN();
+    period_cb = cb;
+    TA0CCTL0 |= CCIE;
+    CRITICAL_SECTION_END();
 }
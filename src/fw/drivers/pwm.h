@@ -5,8 +5,24 @@ typedef enum {
     PWM_DRV8848_RIGHT1,
     PWM_DRV8848_RIGHT2,
     PWM_DRV8848_LEFT1,
-    PWM_DRV8848_LEFT2
+    PWM_DRV8848_LEFT2,
+    PWM_DRV8848_CNT
 } mdrv_enum;
 
+// Duty cycle is given in permille (0-1000)
+#define PWM_DUTY_MAX (1000U)
+// OR'ed into the duty cycle to invert the output, it is then low for the duty
+// cycle and high for the rest of the period (PWM_DUTY_INVERTED alone means
+// constantly high)
+#define PWM_DUTY_INVERTED (0x8000U)
+#define PWM_PERIOD_FREQ_HZ (20000U)
+#define PWM_PERIODS_PER_MS (PWM_PERIOD_FREQ_HZ / 1000U)
+
+// Called from the timer ISR at the end of every PWM period
+typedef void (*pwm_period_cb)(void);
+
 void pwm_init(void);
-void pwm_set_duty_cycle(mdrv_enum, uint8_t);
+void pwm_register_period_cb(pwm_period_cb cb);
+void pwm_disable_all(void);
+void pwm_set_duty_cycle(mdrv_enum, uint16_t);
+void pwm_set_duty_cycles(const uint16_t duty_cycles[PWM_DRV8848_CNT]);
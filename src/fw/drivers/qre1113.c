@@ -1,9 +1,20 @@
 #include "drivers/qre1113.h"
 #include "common/assert_handler.h"
 #include "drivers/adc.h"
+#include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+// The sensors are sampled by the ADC in the order of e__qre1113_pos, so the
+// ADC buffer can be handed out as-is
+static_assert((int)QRE1113_POS_FRONT_LEFT == (int)ADC_CHANNEL_LD_FRONT_LEFT &&
+                  (int)QRE1113_POS_FRONT_RIGHT ==
+                      (int)ADC_CHANNEL_LD_FRONT_RIGHT &&
+                  (int)QRE1113_POS_BACK_LEFT == (int)ADC_CHANNEL_LD_BACK_LEFT &&
+                  (int)QRE1113_POS_BACK_RIGHT == (int)ADC_CHANNEL_LD_BACK_RIGHT,
+              "Expect qre1113 sensors first in IO_ADC_PINS, in e__qre1113_pos "
+              "order");
+
 static bool initialized = false;
 
 void qre1113_init(void) {
@@ -15,8 +26,17 @@ void qre1113_init(void) {
 void qre1113_get_voltages(struct qre1113_voltages *buffer) {
     adc_channel_values_t adc_v_buffer; // Buffer for ADC voltage readings
     adc_get_channel_values(adc_v_buffer);
-    buffer->front_left = adc_v_buffer[0];
-    buffer->front_right = adc_v_buffer[1];
-    buffer->back_left = adc_v_buffer[2];
-    buffer->back_right = adc_v_buffer[3];
+    buffer->front_left = adc_v_buffer[QRE1113_POS_FRONT_LEFT];
+    buffer->front_right = adc_v_buffer[QRE1113_POS_FRONT_RIGHT];
+    buffer->back_left = adc_v_buffer[QRE1113_POS_BACK_LEFT];
+    buffer->back_right = adc_v_buffer[QRE1113_POS_BACK_RIGHT];
+}
+
+/**
+ * Register a function that is called (in ISR context) with the voltages of
+ * all sensors as soon as a new ADC sequence has completed
+ */
+void qre1113_register_voltages_cb(qre1113_voltages_cb cb) {
+    ASSERT(initialized);
+    adc_register_conversion_cb(cb);
 }
@@ -1,5 +1,16 @@
+#ifndef QRE1113_H
+#define QRE1113_H
+#include "drivers/adc.h"
 #include <stdint.h>
 
+typedef enum {
+    QRE1113_POS_FRONT_LEFT,
+    QRE1113_POS_FRONT_RIGHT,
+    QRE1113_POS_BACK_LEFT,
+    QRE1113_POS_BACK_RIGHT,
+    QRE1113_POS_CNT
+} e__qre1113_pos;
+
 struct qre1113_voltages {
     uint16_t front_left;
     uint16_t front_right;
@@ -7,5 +18,11 @@ struct qre1113_voltages {
     uint16_t back_right;
 };
 
+// Voltages are indexed by e__qre1113_pos
+typedef adc_conversion_cb qre1113_voltages_cb;
+
 void qre1113_init(void);
 void qre1113_get_voltages(struct qre1113_voltages *buffer);
+void qre1113_register_voltages_cb(qre1113_voltages_cb cb);
+
+#endif // QRE1113_H
@@ -90,3 +90,15 @@ bool ring_buffer_isempty(const struct ring_buffer *p_buf) {
     return p_buf->r_idx ==
            p_buf->w_idx; // Buffer is empty if write index == read index
 }
+
+/**
+ * Returns the number of elements that can be pushed
+ * before the ring buffer is full
+ */
+uint8_t ring_buffer_space(const struct ring_buffer *p_buf) {
+    const uint8_t w_idx = p_buf->w_idx;
+    const uint8_t r_idx = p_buf->r_idx;
+    const uint8_t used =
+        w_idx >= r_idx ? w_idx - r_idx : p_buf->size - r_idx + w_idx;
+    return p_buf->size - 1U - used; // One element is always left empty
+}
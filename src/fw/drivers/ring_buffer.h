@@ -17,3 +17,4 @@ uint8_t ring_buffer_pop(struct ring_buffer *p_buf);
 uint8_t ring_buffer_peek(struct ring_buffer *p_buf);
 bool ring_buffer_isfull(const struct ring_buffer *p_buf);
 bool ring_buffer_isempty(const struct ring_buffer *p_buf);
+uint8_t ring_buffer_space(const struct ring_buffer *p_buf);
@@ -0,0 +1,123 @@
+#include "drivers/systick.h"
+#include "common/assert_handler.h"
+#include "common/defines.h"
+#include "common/prof.h"
+#include <assert.h>
+#include <msp430.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * TA1 counts at 1 MHz (SMCLK / 8 / 2) in up mode and wraps every ms, so the
+ * timer count is the us within the current ms. The tick interrupt is triggered
+ * when the count reaches TA1CCR0, one timer tick before the wrap. It
+ * increments the ms counter and wakes the CPU up from sleep.
+ */
+#define SYSTICK_TIMER_FREQ_HZ                                                  \
+    (SMCLK / TIMER_INPUT_DIVIER_3 / SYSTICK_TIMER_EX_DIVIDER)
+#define SYSTICK_TIMER_EX_DIVIDER (2U)
+#define SYSTICK_TIMER_TICKS (SYSTICK_TIMER_FREQ_HZ / SYSTICK_FREQ_HZ)
+#define SYSTICK_CYCLES_PER_TIMER_TICK (SMCLK / SYSTICK_TIMER_FREQ_HZ)
+static_assert(SYSTICK_TIMER_FREQ_HZ == 1000000UL, "Expect 1 timer tick per us");
+static_assert(SYSTICK_TIMER_TICKS == SYSTICK_US_PER_TICK,
+              "Expect the timer count in us");
+
+static bool initialized = false;
+static volatile uint32_t millis = 0;
+static systick_tick_cb tick_cb = NULL;
+
+void systick_init(void) {
+    ASSERT(!initialized);
+    TA1CTL = TASSEL_2 | ID_3 | MC_0 | TACLR;
+    TA1EX0 = TAIDEX_1;
+    TA1CCR0 = SYSTICK_TIMER_TICKS - 1;
+    TA1CCTL0 = CCIE;
+    TA1CTL |= MC_1;
+    initialized = true;
+}
+
+/**
+ * Call cb from the tick ISR every ms
+ */
+void systick_register_tick_cb(systick_tick_cb cb) {
+    ASSERT(initialized);
+    ASSERT(!tick_cb);
+    tick_cb = cb;
+}
+
+uint32_t systick_millis(void) {
+    uint32_t now;
+    CRITICAL_SECTION_BEGIN();
+    now = millis;
+    CRITICAL_SECTION_END();
+    return now;
+}
+
+uint32_t systick_micros(void) {
+    uint32_t now_ms;
+    uint16_t count;
+    CRITICAL_SECTION_BEGIN();
+    now_ms = millis;
+    count = TA1R;
+    // The timer may have wrapped after interrupts were disabled, in which case
+    // the ms increment is still pending. A count read just before the wrap is
+    // large, so it can't be confused with one read after.
+    if ((TA1CCTL0 & CCIFG) && count < (SYSTICK_TIMER_TICKS / 2)) {
+        now_ms++;
+    }
+    CRITICAL_SECTION_END();
+    return now_ms * SYSTICK_US_PER_TICK + count;
+}
+
+/**
+ * True if time is later than reference, valid as long as they are less than
+ * half the counter range apart
+ */
+bool systick_is_after(uint32_t time, uint32_t reference) {
+    return (int32_t)(time - reference) > 0;
+}
+
+uint32_t systick_ms_since(uint32_t start_ms) {
+    return systick_millis() - start_ms;
+}
+
+/**
+ * Idle in LPM0 until the ms counter reaches wake_ms. SMCLK keeps running in
+ * LPM0, so the PWM, ADC and UART carry on, and their ISRs are serviced while
+ * sleeping. Must be called with interrupts enabled (and not from an ISR) or
+ * it never wakes up.
+ */
+void systick_sleep_until(uint32_t wake_ms) {
+    ASSERT(initialized);
+    ASSERT((__get_SR_register() & GIE));
+    // Interrupts are disabled between the check and entering LPM0 (which
+    // enables them again), so a tick can't slip in between and be missed
+    __disable_interrupt();
+    while (systick_is_after(wake_ms, millis)) {
+        __bis_SR_register(LPM0_bits | GIE);
+        __disable_interrupt();
+    }
+    __enable_interrupt();
+}
+
+/**
+ * Idle in LPM0 for at least duration_ms (see systick_sleep_until)
+ */
+void systick_sleep_ms(uint32_t duration_ms) {
+    // Plus one, the next tick may come right away
+    systick_sleep_until(systick_millis() + duration_ms + 1);
+}
+
+// The tick is triggered at the last count before the wrap, so the time since
+// then is one timer tick more than the count (and 0 if it hasn't wrapped yet)
+PROF_INTERRUPT_FUNCTION(TIMER1_A0_VECTOR, isr_systick, PROF_ISR_SYSTICK,
+                        ((TA1R + 1U) % SYSTICK_TIMER_TICKS) *
+                            SYSTICK_CYCLES_PER_TIMER_TICK) {
+    millis++;
+    if (tick_cb) {
+        tick_cb();
+    }
+    // Let the sleeping main loop check whether it's time to wake up
+    __bic_SR_register_on_exit(LPM0_bits);
+}
@@ -0,0 +1,24 @@
+#ifndef SYSTICK_H
+#define SYSTICK_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Monotonic time base on timer TA1. The counters are 32-bit and wrap (ms
+ * after ~49 days, us after ~71 minutes), so compare and subtract them with
+ * the helpers below, which are correct across the wrap. */
+
+#define SYSTICK_FREQ_HZ (1000U)
+#define SYSTICK_US_PER_TICK (1000000UL / SYSTICK_FREQ_HZ)
+
+typedef void (*systick_tick_cb)(void);
+
+void systick_init(void);
+void systick_register_tick_cb(systick_tick_cb cb);
+uint32_t systick_millis(void);
+uint32_t systick_micros(void);
+bool systick_is_after(uint32_t time, uint32_t reference);
+uint32_t systick_ms_since(uint32_t start_ms);
+void systick_sleep_ms(uint32_t duration_ms);
+void systick_sleep_until(uint32_t wake_ms);
+
+#endif // SYSTICK_H
@@ -1,15 +1,17 @@
 #include "drivers/uart.h"
 #include "common/assert_handler.h"
 #include "common/defines.h"
+#include "common/prof.h"
 #include "drivers/io.h"
 #include "drivers/ring_buffer.h"
 #include <assert.h>
 #include <msp430.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
-// UART ring buffer constants
-#define UART_BUFFER_SIZE (16U)
+// UART ring buffer constants, room for a few trace lines
+#define UART_BUFFER_SIZE (192U)
 // Initialize UART ring buffer
 static struct ring_buffer *uart_ring_buffer = NULL;
 
@@ -37,6 +39,12 @@ static_assert(UART_MODULATOR < 0x16U, "UART modulator must fit within 4 bits");
 static_assert(UART_UCBRSx < 0x8U, "UART modulator must fit within 3 bits");
 #define UART_UCOS16 (1U) // Enable oversampling
 
+#ifdef LAUNCHPAD
+#define UART_VECTOR (USCI_A1_VECTOR)
+#elif SUMOBOT
+#define UART_VECTOR (USCI_A0_VECTOR)
+#endif
+
 static void uart_tx_enable_interrupt(void) {
 #ifdef LAUNCHPAD
     UCA1IE |= UCTXIE; // Enable UART TX interrupt
@@ -229,6 +237,39 @@ void uart_putchar_interrupt(char c) {
     }
 }
 
+/**
+ * Queue a whole string for the TX interrupt without waiting, '\n' is sent as
+ * "\n\r". Nothing is queued if the string doesn't fit in the ring buffer, and
+ * false is returned.
+ */
+bool uart_puts_interrupt(const char *str) {
+    uint16_t len = 0;
+    for (const char *c = str; *c != '\0'; c++) {
+        len += *c == '\n' ? 2U : 1U;
+    }
+    uart_tx_disable_interrupt(); // Disable interrupts while adding new elements
+                                 // to ring buffer
+    const bool fits = len <= ring_buffer_space(uart_ring_buffer);
+    if (fits) {
+        const bool tx_ongoing = !ring_buffer_isempty(uart_ring_buffer);
+        for (const char *c = str; *c != '\0'; c++) {
+            ring_buffer_push(uart_ring_buffer, *c);
+            if (*c == '\n') {
+                ring_buffer_push(uart_ring_buffer, '\r');
+            }
+        }
+        if (!tx_ongoing) {
+            uart_tx_start();
+        }
+    }
+    // The TX flag is set while idle, so only enable the interrupt while there
+    // is something to pop
+    if (!ring_buffer_isempty(uart_ring_buffer)) {
+        uart_tx_enable_interrupt();
+    }
+    return fits;
+}
+
 void uart_tx_start(void) {
     if (!ring_buffer_isempty(uart_ring_buffer))
 #ifdef LAUNCHPAD
@@ -238,7 +279,8 @@ void uart_tx_start(void) {
 #endif
 }
 
-INTERRUPT_FUNCTION(USCI_A1_VECTOR) uart_tx_isr(void) {
+PROF_INTERRUPT_FUNCTION(UART_VECTOR, uart_tx_isr, PROF_ISR_UART_TX,
+                        PROF_LATENCY_UNKNOWN) {
 #ifdef LAUNCHPAD
     switch (__even_in_range(UCA1IV, 4)) {
     case 0x00: // No interrupt
@@ -1,3 +1,5 @@
+#include <stdbool.h>
+
 
 // void uart_tx_enable_interrupt(void);
 // void uart_tx_disable_interrupt(void);
@@ -5,6 +7,7 @@
 void uart_init(void);
 void uart_putchar_polling(char);
 void uart_putchar_interrupt(char);
+bool uart_puts_interrupt(const char *str);
 void uart_tx_start(void);
 void _putchar(char); // mpaland low-level output function needed for printf()
 
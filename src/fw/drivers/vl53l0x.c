@@ -1,9 +1,12 @@
 #include "drivers/vl53l0x.h"
 #include "common/assert_handler.h"
 #include "common/defines.h"
+#include "common/event.h"
 #include "common/trace.h"
+#include "drivers/debug_marker.h"
 #include "drivers/i2c.h"
 #include "drivers/io.h"
+#include "drivers/systick.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -105,8 +108,8 @@ static e__vl53l0x_result vl53l0x_init_addr(e__vl53l0x_pos pos) {
                                   // next
 
     // t_BOOT time is 1.2ms maximum according to VL53L0X datasheet
-    BUSY_WAIT_ms(3); // Wait 2ms then to ensure VL53L0X device is booted up out
-                     // of HW standby mode
+    systick_sleep_ms(3); // Wait 2ms then to ensure VL53L0X device is booted up
+                         // out of HW standby mode
 
     // Check that the range sensor is booted up before trying to change its
     // slave address by reading back the ID of the range sensor
@@ -499,23 +502,34 @@ static e__vl53l0x_result vl53l0x_load_default_tuning_settings(void) {
 
 // INTERRUPT SERVICE ROUTINE FUNCTIONS FOR INDICATING WHEN RANGE SENSOR
 // MEASUREMENTS ARE FINISHED
+static void vl53l0x_set_multiple_done(void) {
+    status_multiple = STATUS_MULTIPLE_DONE;
+    event_post(EVENT_RANGE_READY, 0);
+}
+
 static void right_measurement_done_isr() {
+    DEBUG_MARKER_HIGH(DEBUG_MARKER_RANGE_ISR);
     status_multiple_front_right = STATUS_SINGLE_DONE;
     if (status_multiple_front_middle == STATUS_SINGLE_DONE &&
         status_multiple_front_left == STATUS_SINGLE_DONE)
-        status_multiple = STATUS_MULTIPLE_DONE;
+        vl53l0x_set_multiple_done();
+    DEBUG_MARKER_LOW(DEBUG_MARKER_RANGE_ISR);
 }
 static void middle_measurement_done_isr() {
+    DEBUG_MARKER_HIGH(DEBUG_MARKER_RANGE_ISR);
     status_multiple_front_middle = STATUS_SINGLE_DONE;
     if (status_multiple_front_right == STATUS_SINGLE_DONE &&
         status_multiple_front_left == STATUS_SINGLE_DONE)
-        status_multiple = STATUS_MULTIPLE_DONE;
+        vl53l0x_set_multiple_done();
+    DEBUG_MARKER_LOW(DEBUG_MARKER_RANGE_ISR);
 }
 static void left_measurement_done_isr() {
+    DEBUG_MARKER_HIGH(DEBUG_MARKER_RANGE_ISR);
     status_multiple_front_left = STATUS_SINGLE_DONE;
     if (status_multiple_front_middle == STATUS_SINGLE_DONE &&
         status_multiple_front_right == STATUS_SINGLE_DONE)
-        status_multiple = STATUS_MULTIPLE_DONE;
+        vl53l0x_set_multiple_done();
+    DEBUG_MARKER_LOW(DEBUG_MARKER_RANGE_ISR);
 }
 
 static e__vl53l0x_result vl53l0x_configure_interrupt(void) {
@@ -763,18 +777,28 @@ e__vl53l0x_result vl53l0x_start_measuring_multiple(void) {
     }
     status_multiple = STATUS_MULTIPLE_MEASURING;
     e__vl53l0x_result result = vl53l0x_start_sysrange(e_VL53L0X_POS_FRONT);
-    if (result != e_VL53L0X_RESULT_OK) {
-        return result;
+    if (result == e_VL53L0X_RESULT_OK) {
+        result = vl53l0x_start_sysrange(e_VL53L0X_POS_FRONT_LEFT);
     }
-    result = vl53l0x_start_sysrange(e_VL53L0X_POS_FRONT_LEFT);
-    if (result != e_VL53L0X_RESULT_OK) {
-        return result;
+    if (result == e_VL53L0X_RESULT_OK) {
+        result = vl53l0x_start_sysrange(e_VL53L0X_POS_FRONT_RIGHT);
     }
-    result = vl53l0x_start_sysrange(e_VL53L0X_POS_FRONT_RIGHT);
     if (result != e_VL53L0X_RESULT_OK) {
-        return result;
+        // Not all sensors are measuring, so the interrupt may never come
+        status_multiple = STATUS_MULTIPLE_NOT_STARTED;
     }
-    return e_VL53L0X_RESULT_OK;
+    return result;
+}
+
+/**
+ * Drop the measurement in progress and start a new one on all sensors, for
+ * when the measurement done interrupt has not come (e.g. it was missed or the
+ * measurement never started)
+ */
+e__vl53l0x_result vl53l0x_restart_measuring_multiple(void) {
+    ASSERT(initialized);
+    status_multiple = STATUS_MULTIPLE_NOT_STARTED;
+    return vl53l0x_start_measuring_multiple();
 }
 
 // Assumes I2C address is set already
@@ -856,8 +880,9 @@ e__vl53l0x_result vl53l0x_read_range_multiple(t__vl53l0x_ranges ranges,
         if (result) {
             return result;
         }
-        // Block here the first time
+        // Block here the first time, sleeping until the sensors are done
         while (status_multiple != STATUS_MULTIPLE_DONE) {
+            systick_sleep_ms(1);
         }
     }
 
@@ -866,28 +891,31 @@ e__vl53l0x_result vl53l0x_read_range_multiple(t__vl53l0x_ranges ranges,
         // Read data from front middle range sensor
         result = vl53l0x_read_range(e_VL53L0X_POS_FRONT,
                                     &latest_ranges[e_VL53L0X_POS_FRONT]);
-        if (result) {
-            return result;
-        }
 
         // Read data from front left range sensor
-        result = vl53l0x_read_range(e_VL53L0X_POS_FRONT_LEFT,
-                                    &latest_ranges[e_VL53L0X_POS_FRONT_LEFT]);
-        if (result) {
-            return result;
+        if (!result) {
+            result = vl53l0x_read_range(
+                e_VL53L0X_POS_FRONT_LEFT,
+                &latest_ranges[e_VL53L0X_POS_FRONT_LEFT]);
         }
 
         // Read data from front rightrange sensor
-        result = vl53l0x_read_range(e_VL53L0X_POS_FRONT_RIGHT,
-                                    &latest_ranges[e_VL53L0X_POS_FRONT_RIGHT]);
-        if (result) {
-            return result;
+        if (!result) {
+            result = vl53l0x_read_range(
+                e_VL53L0X_POS_FRONT_RIGHT,
+                &latest_ranges[e_VL53L0X_POS_FRONT_RIGHT]);
         }
 
-        result = vl53l0x_start_measuring_multiple();
+        // Start the next measurement even if a read failed, nothing else
+        // starts it when the interrupts drive the reads
+        const e__vl53l0x_result start_result =
+            vl53l0x_start_measuring_multiple();
         if (result) {
             return result;
         }
+        if (start_result) {
+            return start_result;
+        }
         // Use new values if sensors are done sensing
         *fresh_values = true;
     } else {
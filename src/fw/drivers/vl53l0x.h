@@ -232,4 +232,5 @@ e__vl53l0x_result vl53l0x_read_range_single(e__vl53l0x_pos pos,
 e__vl53l0x_result vl53l0x_read_range_multiple(t__vl53l0x_ranges ranges,
                                               bool *fresh_values);
 
-e__vl53l0x_result vl53lox_start_measuring_multiple(void);
+e__vl53l0x_result vl53l0x_start_measuring_multiple(void);
+e__vl53l0x_result vl53l0x_restart_measuring_multiple(void);
@@ -1,35 +1,262 @@
+#include "app/drive.h"
+#include "app/escape_table.h"
+#include "app/line.h"
+#include "app/line_geometry.h"
+#include "common/assert_handler.h"
+#include "common/cpu_load.h"
 #include "common/defines.h"
-#include "drivers/io.h"
+#include "common/event.h"
+#include "common/prof.h"
+#include "common/pt.h"
+#include "common/scheduler.h"
+#include "common/stack.h"
+#include "common/trace.h"
 #include "drivers/led.h"
-#include "externals/printf/printf.h"
+#include "drivers/mcu_init.h"
+#include "drivers/systick.h"
+#include "drivers/vl53l0x.h"
+#include "motors/motors.h"
 #include <msp430.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
-#include "common/assert_handler.h"
-#include "drivers/mcu_init.h"
+
+// Robots may only move once this long after the start signal (power up)
+#define START_COUNTDOWN_S (5U)
+// A measurement of all range sensors takes ~30 ms, restart it if there has
+// been none for this long
+#define RANGE_TIMEOUT_MS (200U)
+
+static e__line line = LINE_NONE;
+static t__vl53l0x_ranges ranges;
+static bool started = false;
+static struct pt start_pt;
+static bool range_sensors_ok = false;
+static uint32_t range_ready_ms = 0;
+
+/**
+ * Escape as soon as a line is seen, the crossing angle picks the manoeuvre
+ */
+static void handle_line(const struct event *event) {
+    line = (e__line)event->data;
+    if (!started || line == LINE_NONE) {
+        return;
+    }
+    struct line_crossing crossing;
+    const int16_t angle = line_geometry_get_crossing(0, &crossing)
+                              ? crossing.angle
+                              : ESCAPE_ANGLE_UNKNOWN;
+    drive_escape(line, angle, NULL);
+}
+
+static void handle_range_ready(const struct event *event) {
+    (void)event;
+    range_ready_ms = systick_millis();
+    bool fresh_values;
+    PROF_BEGIN(PROF_RANGE_READ);
+    const e__vl53l0x_result result =
+        vl53l0x_read_range_multiple(ranges, &fresh_values);
+    PROF_END(PROF_RANGE_READ);
+    if (result != e_VL53L0X_RESULT_OK) {
+        TRACE("Range read failed");
+    }
+}
+
+/**
+ * Blink the LED every second of the countdown, then start searching
+ */
+static PT_THREAD(start_countdown(struct pt *pt)) {
+    static uint8_t seconds_left;
+    PT_BEGIN(pt);
+    for (seconds_left = START_COUNTDOWN_S; seconds_left > 0; seconds_left--) {
+        TRACE("Start in %u", seconds_left);
+        set_led(TEST_LED, LED_STATE_ON);
+        PT_WAIT_MS(pt, 500);
+        set_led(TEST_LED, LED_STATE_OFF);
+        PT_WAIT_MS(pt, 500);
+    }
+    TRACE("Start");
+    started = true;
+    // Spin slowly until something more important takes over
+    static const struct motors_command search = {
+        .left_speed = -300,
+        .right_speed = 300,
+        .lifetime_ms = MOTORS_LIFETIME_FOREVER,
+        .unlimited = false,
+    };
+    motors_post(MOTORS_PRIO_SEARCH, &search);
+    PT_END(pt);
+}
+
+static void task_start(void) {
+    if (!started) {
+        start_countdown(&start_pt);
+    }
+}
+
+/**
+ * The range sensors are only read (and restarted) when they are done, so a
+ * missed interrupt or a failed start would stop range sensing for good
+ */
+static void task_range_watchdog(void) {
+    if (!range_sensors_ok ||
+        systick_ms_since(range_ready_ms) < RANGE_TIMEOUT_MS) {
+        return;
+    }
+    range_ready_ms = systick_millis();
+    TRACE("Range sensors stalled, restarting");
+    if (vl53l0x_restart_measuring_multiple() != e_VL53L0X_RESULT_OK) {
+        TRACE("Range measurement start failed");
+    }
+}
+
+static void task_motors(void) {
+    drive_tick();
+    motors_arbitrate();
+}
+
+static void task_telemetry(void);
+
+// Tasks with the tightest deadlines first, the line and range sensors are
+// handled as events as soon as they have something new
+static const struct scheduler_task tasks[] = {
+    {"motors", task_motors, 1, 0},
+    {"cpu load", cpu_load_update, CPU_LOAD_SLOT_MS, 3},
+    {"start", task_start, 10, 5},
+    {"telemetry", task_telemetry, 50, 7},
+    {"range watchdog", task_range_watchdog, 100, 9},
+};
+
+static const char *const event_names[EVENT_CNT] = {
+    [EVENT_LINE] = "line",
+    [EVENT_RANGE_READY] = "range",
+    [EVENT_TIMER] = "timer",
+};
+
+/* Rough MSP430F5529 supply currents at 16 MHz (active) and in LPM0, used to
+ * estimate the charge the MCU alone draws from the battery in a match. The
+ * motors and sensors draw far more, this shows what sleeping saves. */
+#define MCU_ACTIVE_UA (4300UL)
+#define MCU_LPM0_UA (90UL)
+#define MATCH_DURATION_S (180UL)
+
+static void report_cpu_load(uint8_t idx) {
+    (void)idx;
+    TRACE("CPU load %u/1000 (100 ms) %u/1000 (1 s)",
+          cpu_load_get(CPU_LOAD_WINDOW_100MS),
+          cpu_load_get(CPU_LOAD_WINDOW_1S));
+}
+
+static void report_stack(uint8_t idx) {
+    (void)idx;
+    struct stack_usage stack;
+    stack_get_usage(&stack);
+    TRACE("Stack high water %u bytes, %u bytes free", stack.high_water,
+          stack.free);
+}
+
+static void report_task(uint8_t idx) {
+    struct scheduler_task_stats stats;
+    scheduler_get_stats(idx, &stats);
+    TRACE("%s runs %lu wcet %u us jitter %u us overruns %u", tasks[idx].name,
+          stats.run_cnt, stats.wcet_us, stats.max_jitter_us,
+          stats.overrun_cnt);
+}
+
+static void report_event(uint8_t idx) {
+    struct event_stats stats;
+    event_get_stats(idx, &stats);
+    const uint32_t avg_latency_us =
+        stats.dispatch_cnt ? stats.total_latency_us / stats.dispatch_cnt : 0;
+    TRACE("%s events %lu latency avg %lu us max %u us dropped %u",
+          event_names[idx], stats.dispatch_cnt, avg_latency_us,
+          stats.max_latency_us, stats.dropped_cnt);
+}
+
+static void report_power(uint8_t idx) {
+    (void)idx;
+    struct event_power_stats power;
+    event_get_power_stats(&power);
+    const uint32_t elapsed_ms = power.elapsed_us / 1000U;
+    const uint32_t asleep_ms = power.asleep_us / 1000U;
+    if (elapsed_ms) {
+        const uint32_t avg_ua = (MCU_ACTIVE_UA * (elapsed_ms - asleep_ms) +
+                                 MCU_LPM0_UA * asleep_ms) /
+                                elapsed_ms;
+        TRACE("Asleep %lu/%lu ms, MCU %lu uA, %lu uAh per match", asleep_ms,
+              elapsed_ms, avg_ua, (avg_ua * MATCH_DURATION_S) / 3600U);
+    }
+}
+
+static void report_prof(uint8_t idx) { prof_trace_line(idx); }
+
+static void report_trace(uint8_t idx) {
+    (void)idx;
+    TRACE("Trace dropped %u lines", trace_get_dropped_cnt());
+}
+
+/* The telemetry task traces a status line and one line of this report every
+ * run, so it never queues more than the UART sends before the next run. The
+ * statistics are reset once the whole report has been traced. */
+struct report_section {
+    void (*trace_line)(uint8_t idx);
+    uint8_t line_cnt;
+};
+static const struct report_section report[] = {
+    {report_cpu_load, 1},
+    {report_stack, 1},
+    {report_task, ARRAY_SIZE(tasks)},
+    {report_event, EVENT_CNT},
+    {report_power, 1},
+    {report_prof, PROF_TRACE_LINE_CNT},
+    {report_trace, 1},
+};
+
+static void task_telemetry(void) {
+    static uint8_t report_line = 0;
+    TRACE("Line %u Range %u %u %u Level %u", line,
+          ranges[e_VL53L0X_POS_FRONT_LEFT], ranges[e_VL53L0X_POS_FRONT],
+          ranges[e_VL53L0X_POS_FRONT_RIGHT], motors_get_active_prio());
+    uint8_t idx = report_line++;
+    for (uint8_t i = 0; i < ARRAY_SIZE(report); i++) {
+        if (idx < report[i].line_cnt) {
+            report[i].trace_line(idx);
+            return;
+        }
+        idx -= report[i].line_cnt;
+    }
+    // Whole report traced, start over with fresh statistics
+    report_line = 0;
+    event_reset_stats();
+    prof_reset();
+}
 
 int main(void) {
-    //WDTCTL =
-    //    WDTPW |
-    //    WDTHOLD; // stop watchdog timer, otherwise it prevents program from
-                 // running because it keeps restarting from watchdog timeout
-    //init_clocks();
-    //io_init();
     mcu_init();
-    const struct io_config led_config = {.io_sel = IO_SEL_GPIO,
-                                         .io_dir = IO_DIR_OUTPUT,
-                                         .io_ren = IO_REN_DISABLE,
-                                         .io_out = IO_OUT_LOW};
-    config_io(IO_TEST_LED, &led_config);
-    // io_out_enum io_out = IO_OUT_LOW;
-    led_init(); // Check that IO_TEST_LED config is correct
-    led_state_enum led_state = LED_STATE_ON;
-    ASSERT(0)
-    while (1) {
-        //__delay_cycles(1000000);
-        BUSY_WAIT_ms(1000) led_state =
-            (led_state == LED_STATE_OFF) ? LED_STATE_ON : LED_STATE_OFF;
-        set_led(TEST_LED, led_state);
-        // io_out = (io_out == IO_OUT_LOW) ? IO_OUT_HIGH : IO_OUT_LOW;
-        // io_set_out(IO_TEST_LED, io_out);
+    trace_init();
+    led_init();
+    drive_init();
+    event_init();
+    event_register_handler(EVENT_LINE, handle_line);
+    event_register_handler(EVENT_RANGE_READY, handle_range_ready);
+    line_init();
+    range_sensors_ok = vl53l0x_init() == e_VL53L0X_RESULT_OK;
+    if (!range_sensors_ok) {
+        TRACE("Range sensors init failed");
+    } else if (vl53l0x_start_measuring_multiple() != e_VL53L0X_RESULT_OK) {
+        // The range ready event reads the measurement and starts the next
+        // one, the watchdog task starts it again if this fails
+        TRACE("Range measurement start failed");
+    }
+    range_ready_ms = systick_millis();
+    cpu_load_init();
+    if (!cpu_load_self_check()) {
+        TRACE("CPU load self-check failed");
     }
+    PT_INIT(&start_pt);
+    // From now on a trace must not hold up the tasks
+    trace_set_nonblocking(true);
+    scheduler_init(tasks, ARRAY_SIZE(tasks));
+    scheduler_run();
+    return 0;
 }
@@ -0,0 +1,256 @@
+#include "motors/motors.h"
+#include "common/assert_handler.h"
+#include "drivers/drv8848.h"
+#include "drivers/pwm.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+static_assert(MOTORS_SPEED_MAX == PWM_DUTY_MAX,
+              "Speed is expected to map 1:1 to the PWM duty cycle");
+
+/**
+ * Arbiter:
+ * Each priority level has a slot holding its latest command, and the motors
+ * follow the command of the highest level that is active (posted, not
+ * released and not expired). Levels are resolved on every post and release,
+ * so a reflex preempts lower levels right away, and on every arbiter tick so
+ * expired commands fall through to the level below.
+ *
+ * There are no critical sections, a level may be posted from an ISR while the
+ * main loop posts another one or resolves. Each level must only be posted and
+ * released from one context. A slot is guarded by a sequence number that is
+ * odd while its owner writes it: a reader that sees it change reads again,
+ * and a reader that sees it odd (an ISR that interrupted the owner) gives up,
+ * since the owner resolves again once it's done. Every post and release bumps
+ * the generation, so a resolve interrupted by one starts over and the last
+ * resolve to finish always applies the latest winner.
+ */
+
+struct motors_slot {
+    uint16_t seq; // Odd while the owner is writing the slot
+    bool active;
+    uint16_t posted_tick;
+    struct motors_command command;
+};
+
+typedef enum {
+    MOTORS_SLOT_INACTIVE,
+    MOTORS_SLOT_ACTIVE,
+    MOTORS_SLOT_EXPIRED,
+    MOTORS_SLOT_BUSY
+} motors_slot_state_enum;
+
+static bool initialized = false;
+static motors_decay_enum decay = MOTORS_DECAY_FAST;
+static volatile struct motors_slot slots[MOTORS_PRIO_CNT];
+// Seq of the expired command of each slot (if still the latest), only written
+// by the ticks
+#define MOTORS_SEQ_NONE (1U) // Odd, never the seq of a command
+static uint16_t expired_seqs[MOTORS_PRIO_CNT];
+static volatile uint16_t ticks = 0;
+static volatile uint16_t generation = 0;
+// Command currently applied, MOTORS_PRIO_CNT when stopped for lack of one
+static volatile motors_prio_enum applied_prio = MOTORS_PRIO_CNT;
+static volatile uint16_t applied_seq = 0;
+
+void motors_init(void) {
+    ASSERT(!initialized);
+    drv8848_init();
+    for (motors_prio_enum prio = 0; prio < MOTORS_PRIO_CNT; prio++) {
+        expired_seqs[prio] = MOTORS_SEQ_NONE;
+    }
+    initialized = true;
+}
+
+static inline drv8848_mode_enum motors_speed_to_mode(int16_t speed) {
+    if (speed > 0) {
+        return decay == MOTORS_DECAY_SLOW ? DRV8848_MODE_FORWARD_SLOW_DECAY
+                                          : DRV8848_MODE_FORWARD;
+    } else if (speed < 0) {
+        return decay == MOTORS_DECAY_SLOW ? DRV8848_MODE_REVERSE_SLOW_DECAY
+                                          : DRV8848_MODE_REVERSE;
+    }
+    // With slow decay, 0 speed ramps down in slow decay and then holds brake
+    return decay == MOTORS_DECAY_SLOW ? DRV8848_MODE_FORWARD_SLOW_DECAY
+                                      : DRV8848_MODE_COAST;
+}
+
+/**
+ * Select how the motor current decays in the PWM off-time for the following
+ * speed changes. Slow decay brakes in the off-time, so the speed follows the
+ * command more closely and drops faster when slowing down.
+ */
+void motors_set_decay(motors_decay_enum new_decay) { decay = new_decay; }
+
+/**
+ * Brake both motors for the given time, then coast
+ */
+void motors_brake(uint16_t duration_ms) {
+    ASSERT(initialized);
+    drv8848_brake(duration_ms);
+}
+
+static inline uint16_t motors_speed_to_duty_cycle(int16_t speed) {
+    return speed < 0 ? (uint16_t)-speed : (uint16_t)speed;
+}
+
+static inline void motors_assert_speeds(int16_t left_speed,
+                                        int16_t right_speed) {
+    ASSERT(initialized);
+    ASSERT((left_speed >= -MOTORS_SPEED_MAX && left_speed <= MOTORS_SPEED_MAX));
+    ASSERT(
+        (right_speed >= -MOTORS_SPEED_MAX && right_speed <= MOTORS_SPEED_MAX));
+}
+
+/**
+ * Set the speed of both motors in one go. The inputs of both drivers are
+ * computed together and committed in the same PWM period, inputs that don't
+ * change are not written. The speed is ramped by the drv8848 slew limiter.
+ * Bypasses the arbiter, so not for use along with motors_post().
+ */
+void motors_set(int16_t left_speed, int16_t right_speed) {
+    motors_assert_speeds(left_speed, right_speed);
+    drv8848_set_modes(motors_speed_to_mode(left_speed),
+                      motors_speed_to_duty_cycle(left_speed),
+                      motors_speed_to_mode(right_speed),
+                      motors_speed_to_duty_cycle(right_speed));
+}
+
+/**
+ * Same as motors_set, but applies the speed right away without ramping. Only
+ * meant for emergencies such as escaping the line.
+ */
+void motors_set_unlimited(int16_t left_speed, int16_t right_speed) {
+    motors_assert_speeds(left_speed, right_speed);
+    drv8848_set_modes_unlimited(motors_speed_to_mode(left_speed),
+                                motors_speed_to_duty_cycle(left_speed),
+                                motors_speed_to_mode(right_speed),
+                                motors_speed_to_duty_cycle(right_speed));
+}
+
+static motors_slot_state_enum
+motors_read_slot(motors_prio_enum prio, struct motors_command *command,
+                 uint16_t *seq) {
+    volatile struct motors_slot *slot = &slots[prio];
+    uint16_t seq_before;
+    bool active;
+    uint16_t posted_tick;
+    do {
+        seq_before = slot->seq;
+        if (seq_before & 1U) {
+            return MOTORS_SLOT_BUSY;
+        }
+        active = slot->active;
+        posted_tick = slot->posted_tick;
+        *command = slot->command;
+    } while (seq_before != slot->seq);
+    *seq = seq_before;
+    if (!active || seq_before == expired_seqs[prio]) {
+        return MOTORS_SLOT_INACTIVE;
+    }
+    if (command->lifetime_ms != MOTORS_LIFETIME_FOREVER &&
+        (uint16_t)(ticks - posted_tick) >= command->lifetime_ms) {
+        return MOTORS_SLOT_EXPIRED;
+    }
+    return MOTORS_SLOT_ACTIVE;
+}
+
+/**
+ * Apply the command of the highest active level, or stop if there is none.
+ * Cost is O(levels), the command is only applied when the winner changes so
+ * a brake or ramp in progress isn't restarted every tick.
+ */
+static void motors_resolve(void) {
+    uint16_t start_generation;
+    do {
+        start_generation = generation;
+        motors_prio_enum prio;
+        struct motors_command command;
+        uint16_t seq = 0;
+        for (prio = 0; prio < MOTORS_PRIO_CNT; prio++) {
+            const motors_slot_state_enum state =
+                motors_read_slot(prio, &command, &seq);
+            if (state == MOTORS_SLOT_BUSY) {
+                return;
+            } else if (state == MOTORS_SLOT_ACTIVE) {
+                break;
+            }
+        }
+        if (prio == MOTORS_PRIO_CNT) {
+            seq = 0;
+        }
+        if (prio != applied_prio || seq != applied_seq) {
+            if (prio == MOTORS_PRIO_CNT) {
+                motors_set(0, 0);
+            } else if (command.unlimited) {
+                motors_set_unlimited(command.left_speed, command.right_speed);
+            } else {
+                motors_set(command.left_speed, command.right_speed);
+            }
+            applied_prio = prio;
+            applied_seq = seq;
+        }
+    } while (start_generation != generation);
+}
+
+/**
+ * Post a command at the given level, it replaces the previous command of the
+ * level and takes effect right away if no higher level is active. Can be
+ * called from an ISR.
+ */
+void motors_post(motors_prio_enum prio, const struct motors_command *command) {
+    ASSERT(initialized);
+    ASSERT((prio < MOTORS_PRIO_CNT));
+    motors_assert_speeds(command->left_speed, command->right_speed);
+    volatile struct motors_slot *slot = &slots[prio];
+    slot->seq++;
+    slot->command = *command;
+    slot->posted_tick = ticks;
+    slot->active = true;
+    slot->seq++;
+    generation++;
+    motors_resolve();
+}
+
+/**
+ * Withdraw the command of the given level, the motors fall back to the next
+ * active level (or stop). Can be called from an ISR.
+ */
+void motors_release(motors_prio_enum prio) {
+    ASSERT(initialized);
+    ASSERT((prio < MOTORS_PRIO_CNT));
+    volatile struct motors_slot *slot = &slots[prio];
+    slot->seq++;
+    slot->active = false;
+    slot->seq++;
+    generation++;
+    motors_resolve();
+}
+
+/**
+ * Age the commands and resolve the winner, call every MOTORS_ARBITER_TICK_MS
+ */
+void motors_arbitrate(void) {
+    ASSERT(initialized);
+    ticks += MOTORS_ARBITER_TICK_MS;
+    // Remember expired commands, so they don't come back when ticks wraps,
+    // and forget them once replaced, so they can't match a wrapped seq
+    for (motors_prio_enum prio = 0; prio < MOTORS_PRIO_CNT; prio++) {
+        struct motors_command command;
+        uint16_t seq;
+        const motors_slot_state_enum state =
+            motors_read_slot(prio, &command, &seq);
+        if (state == MOTORS_SLOT_EXPIRED) {
+            expired_seqs[prio] = seq;
+        } else if (state != MOTORS_SLOT_BUSY && seq != expired_seqs[prio]) {
+            expired_seqs[prio] = MOTORS_SEQ_NONE;
+        }
+    }
+    motors_resolve();
+}
+
+/**
+ * Level the motors currently follow, MOTORS_PRIO_CNT if none
+ */
+motors_prio_enum motors_get_active_prio(void) { return applied_prio; }
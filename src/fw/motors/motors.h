@@ -0,0 +1,42 @@
+#ifndef MOTORS_H
+#define MOTORS_H
+#include <stdbool.h>
+#include <stdint.h>
+
+// Speed in permille of full speed, positive is forward and negative reverse
+#define MOTORS_SPEED_MAX (1000)
+
+typedef enum { MOTORS_DECAY_FAST, MOTORS_DECAY_SLOW } motors_decay_enum;
+
+// Levels of the arbiter, highest priority first
+typedef enum {
+    MOTORS_PRIO_SAFETY, // Faults, start/stop of the match
+    MOTORS_PRIO_LINE,   // Escaping the line
+    MOTORS_PRIO_ATTACK, // Pushing the enemy
+    MOTORS_PRIO_SEARCH, // Looking for the enemy
+    MOTORS_PRIO_CNT
+} motors_prio_enum;
+
+// motors_arbitrate() must be called with this period
+#define MOTORS_ARBITER_TICK_MS (1U)
+// Lifetime of a command that holds until it's released
+#define MOTORS_LIFETIME_FOREVER (0U)
+
+struct motors_command {
+    int16_t left_speed;
+    int16_t right_speed;
+    uint16_t lifetime_ms; // Expires after this time unless posted again
+    bool unlimited;       // Bypass the slew limiter
+};
+
+void motors_init(void);
+void motors_set_decay(motors_decay_enum decay);
+void motors_brake(uint16_t duration_ms);
+void motors_set(int16_t left_speed, int16_t right_speed);
+void motors_set_unlimited(int16_t left_speed, int16_t right_speed);
+void motors_post(motors_prio_enum prio, const struct motors_command *command);
+void motors_release(motors_prio_enum prio);
+void motors_arbitrate(void);
+motors_prio_enum motors_get_active_prio(void);
+
+#endif // MOTORS_H
@@ -1,7 +1,12 @@
 #include <msp430.h>
 #include <stdint.h>
 #include "app/line.h"
+#include "app/line_geometry.h"
+#include "app/drive.h"
+#include "app/escape_table.h"
 #include "drivers/mcu_init.h"
+#include "drivers/systick.h"
+#include "drivers/debug_marker.h"
 #include "drivers/led.h"
 #include "drivers/io.h"
 #include "drivers/uart.h"
@@ -11,15 +16,23 @@
 #include "drivers/i2c.h"
 #include "drivers/qre1113.h"
 #include "drivers/vl53l0x.h"
+#include "motors/motors.h"
 #include "common/defines.h"
 #include "common/assert_handler.h"
+#include "common/cpu_load.h"
+#include "common/prof.h"
+#include "common/pt.h"
+#include "common/scheduler.h"
+#include "common/stack.h"
+#include "common/timer_wheel.h"
+#include "common/event.h"
 #include "common/trace.h"
 #include "externals/printf/printf.h"
 
 SUPPRESS_UNUSED
 static void test_setup(void) {
     mcu_init();
-//    BUSY_WAIT_ms(1000)
+//    systick_sleep_ms(1000);
 }
 
 SUPPRESS_UNUSED
@@ -39,7 +52,7 @@ static void test_blink_led(void) {
     led_init(); // Check that IO_TEST_LED config is correct
     led_state_enum led_state = LED_STATE_ON;
     while (1) {
-        BUSY_WAIT_ms(1000)
+        systick_sleep_ms(1000);
         led_state = (led_state == LED_STATE_OFF) ? LED_STATE_ON : LED_STATE_OFF;
         set_led(TEST_LED, led_state);
     }
@@ -99,7 +112,7 @@ static void test_putchar(void) {
         _putchar('l');
         _putchar('d');
         _putchar('\n');
-        BUSY_WAIT_ms(1000);
+        systick_sleep_ms(1000);
     }
 }
 
@@ -109,7 +122,7 @@ static void test_printf(void) {
     uart_init();
     while(1) {
         printf("Hello World! %d\n", 2025); 
-        BUSY_WAIT_ms(1000);
+        systick_sleep_ms(1000);
     }
 }
 
@@ -119,7 +132,7 @@ static void test_trace(void) {
     trace_init();
     while(1) {
         TRACE("Hello World! %d\n", 2025);
-        BUSY_WAIT_ms(1000);
+        systick_sleep_ms(1000);
     }
 }
 
@@ -140,7 +153,7 @@ static void test_uart_polling(void) {
         uart_putchar_polling('l');
         uart_putchar_polling('d');
         uart_putchar_polling('\n');
-        BUSY_WAIT_ms(1000);
+        systick_sleep_ms(1000);
     }
 }
 
@@ -161,7 +174,7 @@ static void test_uart_interrupt(void) {
         uart_putchar_interrupt('l');
         uart_putchar_interrupt('d');
         uart_putchar_interrupt('\n');
-        BUSY_WAIT_ms(500);
+        systick_sleep_ms(500);
     }
 }
 
@@ -170,24 +183,24 @@ static void test_pwm(void) {
     test_setup();
     trace_init();
     pwm_init();
-    const uint8_t duty_cycles[6] = {100, 75, 50, 25, 1, 0};
+    const uint16_t duty_cycles[6] = {PWM_DUTY_MAX, 750, 500, 250, 1, 0};
     const uint16_t wait_time = 3000;
     while(1) {
         for(uint8_t i = 0; i < ARRAY_SIZE(duty_cycles); i++) {
-            TRACE("Set duty cycle for IN1 to %d for %d ms", duty_cycles[i], wait_time);
+            TRACE("Set duty cycle for IN1 to %u permille for %d ms", duty_cycles[i], wait_time);
             pwm_set_duty_cycle(DRV8848_RIGHT1, duty_cycles[i]);
             pwm_set_duty_cycle(DRV8848_RIGHT2, 0);
             pwm_set_duty_cycle(DRV8848_LEFT1, duty_cycles[i]);
             pwm_set_duty_cycle(DRV8848_LEFT2, 0);
-            BUSY_WAIT_ms(wait_time);
+            systick_sleep_ms(wait_time);
         }
         for(uint8_t i = 0; i < ARRAY_SIZE(duty_cycles); i++) {
-            TRACE("Set duty cycle for IN2 to %d for %d ms", duty_cycles[i], wait_time);
+            TRACE("Set duty cycle for IN2 to %u permille for %d ms", duty_cycles[i], wait_time);
             pwm_set_duty_cycle(DRV8848_RIGHT1, 0);
             pwm_set_duty_cycle(DRV8848_RIGHT2, duty_cycles[i]); 
             pwm_set_duty_cycle(DRV8848_LEFT1, 0);
             pwm_set_duty_cycle(DRV8848_LEFT2, duty_cycles[i]);
-            BUSY_WAIT_ms(wait_time);
+            systick_sleep_ms(wait_time);
         }
     }
 }
@@ -197,22 +210,566 @@ static void test_drv8848(void) {
     test_setup();
     trace_init();
     drv8848_init();
-    const uint8_t duty_cycles[6] = {100, 75, 50, 25, 1, 0};
+    const uint16_t duty_cycles[6] = {PWM_DUTY_MAX, 750, 500, 250, 1, 0};
     const drv8848_mode_enum drv8848_modes[4] = {DRV8848_MODE_FORWARD, DRV8848_MODE_COAST, DRV8848_MODE_REVERSE, DRV8848_MODE_STOP};
     const char* drv8848_mode_names[4] = {"COAST", "FORWARD", "REVERSE", "BRAKE"};
     const uint16_t wait_time = 3000;
     while(1) {
         for(uint8_t i = 0; i < ARRAY_SIZE(drv8848_modes); i++) {
             for(uint8_t j = 0; j < ARRAY_SIZE(duty_cycles); j++) {
-                TRACE("Set drv8848 mode to %s with duty cycle %d", drv8848_mode_names[drv8848_modes[i]], duty_cycles[j]);
+                TRACE("Set drv8848 mode to %s with duty cycle %u permille", drv8848_mode_names[drv8848_modes[i]], duty_cycles[j]);
                 drv8848_set_mode(MOTORS_RIGHT, drv8848_modes[i], duty_cycles[j]);
                 drv8848_set_mode(MOTORS_LEFT, drv8848_modes[i], duty_cycles[j]);
-                BUSY_WAIT_ms(wait_time);
+                systick_sleep_ms(wait_time);
             }
         }
     }
 }
 
+SUPPRESS_UNUSED
+static void test_motors(void) {
+    test_setup();
+    trace_init();
+    motors_init();
+    // Forward, pivot left, pivot right, reverse, arc and stop
+    const int16_t speeds[][2] = {{500, 500}, {-500, 500}, {500, -500},
+                                 {-500, -500}, {MOTORS_SPEED_MAX, 250}, {0, 0}};
+    const uint16_t wait_time = 3000;
+    while(1) {
+        for(uint8_t i = 0; i < ARRAY_SIZE(speeds); i++) {
+            TRACE("Set motors to left %d right %d for %d ms", speeds[i][0], speeds[i][1], wait_time);
+            motors_set(speeds[i][0], speeds[i][1]);
+            systick_sleep_ms(wait_time);
+        }
+    }
+}
+
+SUPPRESS_UNUSED
+static void arbiter_line_reflex(e__line line) {
+    // Runs in the ADC DMA ISR, preempts the lower levels right away
+    if (line != LINE_NONE) {
+        const struct motors_command reverse = {-800, -800, 300, true};
+        motors_post(MOTORS_PRIO_LINE, &reverse);
+    }
+}
+
+/**
+ * Search slowly forever, attack in short bursts every 2 s and reverse from
+ * the line reflex, the active level is traced when it changes
+ */
+SUPPRESS_UNUSED
+static void test_motors_arbiter(void) {
+    test_setup();
+    trace_init();
+    motors_init();
+    line_init();
+    const struct motors_command search = {200, 400, MOTORS_LIFETIME_FOREVER, false};
+    const struct motors_command attack = {MOTORS_SPEED_MAX, MOTORS_SPEED_MAX, 500, false};
+    motors_post(MOTORS_PRIO_SEARCH, &search);
+    line_register_reflex(arbiter_line_reflex);
+    motors_prio_enum prev_prio = MOTORS_PRIO_CNT;
+    uint16_t ms = 0;
+    uint32_t wake_ms = systick_millis();
+    while (1) {
+        ms += MOTORS_ARBITER_TICK_MS;
+        if (ms >= 2000) {
+            ms = 0;
+            motors_post(MOTORS_PRIO_ATTACK, &attack);
+        }
+        motors_arbitrate();
+        const motors_prio_enum prio = motors_get_active_prio();
+        if (prio != prev_prio) {
+            TRACE("Active level %u", prio);
+            prev_prio = prio;
+        }
+        systick_sleep_until(wake_ms += MOTORS_ARBITER_TICK_MS);
+    }
+}
+
+static void scheduler_test_blink(void) {
+    static led_state_enum led_state = LED_STATE_OFF;
+    led_state = (led_state == LED_STATE_OFF) ? LED_STATE_ON : LED_STATE_OFF;
+    set_led(TEST_LED, led_state);
+}
+
+static void scheduler_test_overrun(void) {
+    // Takes longer than its period every 10th run
+    static uint8_t cnt = 0;
+    if (++cnt == 10) {
+        cnt = 0;
+        BUSY_WAIT_ms(3);
+    }
+}
+
+static void scheduler_test_stats(void);
+
+static const struct scheduler_task scheduler_test_tasks[] = {
+    {"overrun", scheduler_test_overrun, 2, 0},
+    {"blink", scheduler_test_blink, 500, 0},
+    {"stats", scheduler_test_stats, 1000, 1},
+};
+
+static void scheduler_test_stats(void) {
+    for (uint8_t i = 0; i < ARRAY_SIZE(scheduler_test_tasks); i++) {
+        struct scheduler_task_stats stats;
+        scheduler_get_stats(i, &stats);
+        TRACE("%s runs %lu wcet %u us jitter %u us overruns %u", scheduler_test_tasks[i].name,
+              stats.run_cnt, stats.wcet_us, stats.max_jitter_us, stats.overrun_cnt);
+    }
+}
+
+/**
+ * The overrun task should report a wcet above 3 ms and an overrun every 10
+ * runs, and the blink task the jitter it causes
+ */
+SUPPRESS_UNUSED
+static void test_scheduler(void) {
+    test_setup();
+    trace_init();
+    led_init();
+    scheduler_init(scheduler_test_tasks, ARRAY_SIZE(scheduler_test_tasks));
+    scheduler_run();
+}
+
+static PT_THREAD(pt_test_blink(struct pt *pt)) {
+    PT_BEGIN(pt);
+    while (1) {
+        set_led(TEST_LED, LED_STATE_ON);
+        PT_WAIT_MS(pt, 100);
+        set_led(TEST_LED, LED_STATE_OFF);
+        PT_WAIT_MS(pt, 900);
+    }
+    PT_END(pt);
+}
+
+static PT_THREAD(pt_test_count(struct pt *pt)) {
+    static uint8_t i;
+    PT_BEGIN(pt);
+    for (i = 0; i < 10; i++) {
+        TRACE("Count %u", i);
+        PT_WAIT_MS(pt, 300);
+    }
+    PT_END(pt);
+}
+
+/**
+ * Two protothreads interleaved, the LED blinks once per second while the
+ * count restarts every 3 seconds
+ */
+SUPPRESS_UNUSED
+static void test_protothreads(void) {
+    test_setup();
+    trace_init();
+    led_init();
+    struct pt blink_pt, count_pt;
+    PT_INIT(&blink_pt);
+    PT_INIT(&count_pt);
+    uint32_t wake_ms = systick_millis();
+    while (1) {
+        pt_test_blink(&blink_pt);
+        if (!PT_SCHEDULE(pt_test_count(&count_pt)))
+            TRACE("Count ended");
+        systick_sleep_until(++wake_ms);
+    }
+}
+
+#define TIMER_TEST_CNT (24U)
+static struct timer_wheel_timer test_timers[TIMER_TEST_CNT];
+static volatile uint8_t timer_test_isr_cnt = 0;
+static uint8_t timer_test_deferred_cnt = 0;
+
+static void timer_test_isr_cb(void) { timer_test_isr_cnt++; }
+static void timer_test_deferred_cb(void) { timer_test_deferred_cnt++; }
+
+/**
+ * Starts timers from 2 ms to ~41 s, half called back from the ISR and half
+ * from the main loop, and cancels a few. Every second the counts are traced,
+ * they should stop at 10 (ISR) and 10 (deferred).
+ */
+SUPPRESS_UNUSED
+static void test_timer_wheel(void) {
+    test_setup();
+    trace_init();
+    event_init();
+    uint32_t delay_ms = 2;
+    for (uint8_t i = 0; i < TIMER_TEST_CNT; i++) {
+        const bool isr = i & 1;
+        timer_wheel_init_timer(&test_timers[i], isr ? timer_test_isr_cb : timer_test_deferred_cb,
+                               isr ? TIMER_WHEEL_ISR : TIMER_WHEEL_DEFERRED);
+        timer_wheel_start(&test_timers[i], delay_ms);
+        delay_ms = delay_ms * 3 / 2 + 1;
+    }
+    for (uint8_t i = 10; i < 14; i++)
+        timer_wheel_cancel(&test_timers[i]);
+    const uint32_t start_ms = systick_millis();
+    uint32_t wake_ms = start_ms;
+    uint32_t report_ms = start_ms + 1000;
+    while (1) {
+        event_dispatch();
+        if (!systick_is_after(report_ms, systick_millis())) {
+            report_ms += 1000;
+            TRACE("%lu ms: ISR %u deferred %u", systick_ms_since(start_ms), timer_test_isr_cnt,
+                  timer_test_deferred_cnt);
+        }
+        systick_sleep_until(++wake_ms);
+    }
+}
+
+/**
+ * Times a known delay, which should come out at its cycle count, then traces
+ * the line and ADC sections every second (the line sensors must be on).
+ */
+SUPPRESS_UNUSED
+static void test_prof(void) {
+    test_setup();
+    trace_init();
+    const uint32_t start = prof_cycles();
+    __delay_cycles(16000);
+    TRACE("16000 cycle delay took %lu cycles", prof_cycles() - start);
+    line_init();
+    while (1) {
+        systick_sleep_ms(1000);
+        prof_dump();
+        prof_reset();
+    }
+}
+
+/**
+ * Blocks interrupts for up to ~1 ms at a time, which should show up in the
+ * systick latency histogram traced every second
+ */
+SUPPRESS_UNUSED
+static void test_prof_isr(void) {
+    test_setup();
+    trace_init();
+    // Each second interrupts are blocked for 1000, 9000 or 15000 cycles
+    uint8_t phase = 0;
+    while (1) {
+        for (uint8_t i = 0; i < 100; i++) {
+            __disable_interrupt();
+            __delay_cycles(1000);
+            if (phase > 0)
+                __delay_cycles(8000);
+            if (phase > 1)
+                __delay_cycles(6000);
+            __enable_interrupt();
+            systick_sleep_ms(10);
+        }
+        TRACE("Blocked phase %u", phase);
+        prof_dump();
+        prof_reset();
+        phase = (phase + 1) % 3;
+    }
+}
+
+/**
+ * Busy waits 2.5 ms out of every 10 ms, the load traced every second should
+ * be a little above 250/1000 in both windows
+ */
+SUPPRESS_UNUSED
+static void test_cpu_load(void) {
+    test_setup();
+    trace_init();
+    event_init();
+    cpu_load_init();
+    if (!cpu_load_self_check())
+        TRACE("Self-check failed");
+    uint32_t wake_ms = systick_millis();
+    uint8_t slot_cnt = 0;
+    while (1) {
+        __delay_cycles(40000);
+        wake_ms += CPU_LOAD_SLOT_MS;
+        event_sleep_until(wake_ms);
+        cpu_load_update();
+        if (++slot_cnt == 100) {
+            slot_cnt = 0;
+            TRACE("Load %u/1000 (100 ms) %u/1000 (1 s)", cpu_load_get(CPU_LOAD_WINDOW_100MS),
+                  cpu_load_get(CPU_LOAD_WINDOW_1S));
+        }
+    }
+}
+
+static uint16_t stack_test_use(uint16_t byte_cnt) {
+    volatile uint8_t buffer[256];
+    uint16_t sum = 0;
+    for (uint16_t i = 0; i < byte_cnt && i < sizeof(buffer); i++) {
+        buffer[i] = (uint8_t)i;
+        sum += buffer[i];
+    }
+    return sum;
+}
+
+/**
+ * Uses 64 more bytes of a stack buffer every second. Once that is deeper than
+ * the trace calls, the high water mark should grow by ~64 bytes a second until
+ * the whole buffer has been used, and then stay put
+ */
+SUPPRESS_UNUSED
+static void test_stack(void) {
+    test_setup();
+    trace_init();
+    uint16_t byte_cnt = 0;
+    while (1) {
+        stack_test_use(byte_cnt);
+        struct stack_usage stack;
+        stack_get_usage(&stack);
+        TRACE("Used %u bytes, high water %u bytes, %u bytes free", byte_cnt,
+              stack.high_water, stack.free);
+        byte_cnt += 64;
+        systick_sleep_ms(1000);
+    }
+}
+
+/**
+ * Build with MARKERS=1, the markers then toggle every 1, 2, 3 and 4 ms (range,
+ * ADC, line, PWM) to check the logic analyser hookup
+ */
+SUPPRESS_UNUSED
+static void test_debug_markers(void) {
+    test_setup();
+    trace_init();
+#ifndef DEBUG_MARKERS
+    TRACE("Debug markers disabled, build with MARKERS=1");
+#endif
+    uint8_t ms = 0;
+    uint32_t wake_ms = systick_millis();
+    while (1) {
+        ms = ms == 11 ? 0 : ms + 1; // Wrap at a multiple of all the periods
+        DEBUG_MARKER_TOGGLE(DEBUG_MARKER_RANGE_ISR);
+        if (ms % 2 == 0)
+            DEBUG_MARKER_TOGGLE(DEBUG_MARKER_ADC_DMA);
+        if (ms % 3 == 0)
+            DEBUG_MARKER_TOGGLE(DEBUG_MARKER_LINE);
+        if (ms % 4 == 0)
+            DEBUG_MARKER_TOGGLE(DEBUG_MARKER_PWM);
+        systick_sleep_until(++wake_ms);
+    }
+}
+
+SUPPRESS_UNUSED
+static uint16_t stopping_read_range(void) {
+    uint16_t range = VL53L0X_OUT_OF_RANGE;
+    if (vl53l0x_read_range_single(e_VL53L0X_POS_FRONT, &range) != e_VL53L0X_RESULT_OK)
+        TRACE("Range measure failed");
+    return range;
+}
+
+/**
+ * Compare the stopping distance and time of the stop profiles. Place the robot
+ * ~1m in front of a wall, it drives towards it, stops when the range drops
+ * below the trigger range and reports how far it travelled after the trigger
+ * and how many range samples (~30ms each) it took to come to a standstill.
+ * It then backs up and repeats with the next profile.
+ */
+SUPPRESS_UNUSED
+static void test_stopping_distance(void) {
+    test_setup();
+    trace_init();
+    motors_init();
+    if (vl53l0x_init() != e_VL53L0X_RESULT_OK)
+            TRACE("vl53l0x_init failed");
+    typedef enum { STOP_COAST, STOP_SLOW_DECAY, STOP_BRAKE_PULSE, STOP_BRAKE_HOLD } stop_profile;
+    const char *profile_names[] = {"coast", "slow decay ramp down", "brake pulse", "brake hold"};
+    const int16_t drive_speed = 600;
+    const uint16_t trigger_range = 400;
+    const uint16_t start_range = 900;
+    const uint16_t brake_pulse_ms = 150;
+    const uint8_t still_samples = 3; // Same range this many times in a row
+    while (1) {
+        for (stop_profile profile = STOP_COAST; profile <= STOP_BRAKE_HOLD; profile++) {
+            motors_set_decay(MOTORS_DECAY_FAST);
+            motors_set(drive_speed, drive_speed);
+            uint16_t range = stopping_read_range();
+            while (range > trigger_range)
+                range = stopping_read_range();
+            const uint16_t range_at_trigger = range;
+            switch (profile) {
+            case STOP_COAST:
+                motors_set_unlimited(0, 0);
+                break;
+            case STOP_SLOW_DECAY:
+                motors_set_decay(MOTORS_DECAY_SLOW);
+                motors_set(0, 0);
+                break;
+            case STOP_BRAKE_PULSE:
+                motors_brake(brake_pulse_ms);
+                break;
+            case STOP_BRAKE_HOLD:
+                drv8848_set_modes(DRV8848_MODE_STOP, 0, DRV8848_MODE_STOP, 0);
+                break;
+            }
+            uint16_t samples = 0;
+            uint8_t still = 0;
+            uint16_t prev_range = range_at_trigger;
+            while (still < still_samples) {
+                range = stopping_read_range();
+                samples++;
+                still = range == prev_range ? still + 1 : 0;
+                prev_range = range;
+            }
+            samples -= still_samples;
+            // Negative if the robot bounced back past the trigger point
+            const int16_t stopping_distance =
+                (int16_t)range_at_trigger - (int16_t)range;
+            TRACE("%s: stopped after %d mm in %u samples", profile_names[profile],
+                  stopping_distance, samples);
+            // Back up for the next profile
+            motors_set(-drive_speed, -drive_speed);
+            while (stopping_read_range() < start_range) {}
+            motors_set(0, 0);
+            systick_sleep_ms(2000);
+        }
+    }
+}
+
+/**
+ * Helps fill in the drv8848 calibration. Put the robot on a stand first, each
+ * motor is swept up from 0 in both directions, note the duty cycle at which
+ * the wheel starts turning (deadband). Then put it on the floor with the
+ * calibration filled into test_calibrations, it drives straight forward and
+ * back at a few speeds, lower max of the faster motor until it stops curving.
+ * Copy the values to drv8848_default_calibration once done.
+ */
+SUPPRESS_UNUSED
+static void test_drv8848_calibration(void) {
+    test_setup();
+    trace_init();
+    drv8848_init();
+    drv8848_set_slew_rate(DRV8848_SLEW_UNLIMITED, DRV8848_SLEW_UNLIMITED);
+    const char *side_names[] = {"right", "left"};
+    const char *dir_names[] = {"forward", "reverse"};
+    const struct drv8848_calibration uncalibrated = {0, PWM_DUTY_MAX};
+    const struct drv8848_calibration test_calibrations[MOTORS_SIDE_CNT][DRV8848_DIR_CNT] = {
+        [MOTORS_RIGHT] = {{0, PWM_DUTY_MAX}, {0, PWM_DUTY_MAX}},
+        [MOTORS_LEFT] = {{0, PWM_DUTY_MAX}, {0, PWM_DUTY_MAX}}};
+    const uint16_t sweep_max = 400;
+    const uint16_t sweep_step = 10;
+    const uint16_t straight_speeds[] = {300, 600, PWM_DUTY_MAX};
+
+    // Deadband sweep
+    for (motor_side_enum side = MOTORS_RIGHT; side < MOTORS_SIDE_CNT; side++) {
+        for (drv8848_dir_enum dir = DRV8848_DIR_FORWARD; dir < DRV8848_DIR_CNT; dir++) {
+            drv8848_set_calibration(side, dir, &uncalibrated);
+            for (uint16_t duty = 0; duty <= sweep_max; duty += sweep_step) {
+                TRACE("%s %s duty %u", side_names[side], dir_names[dir], duty);
+                drv8848_set_mode(side, dir == DRV8848_DIR_FORWARD ? DRV8848_MODE_FORWARD : DRV8848_MODE_REVERSE, duty);
+                systick_sleep_ms(500);
+            }
+            drv8848_set_mode(side, DRV8848_MODE_COAST, 0);
+            systick_sleep_ms(2000);
+        }
+    }
+
+    // Straight runs with the calibration under test
+    for (motor_side_enum side = MOTORS_RIGHT; side < MOTORS_SIDE_CNT; side++)
+        for (drv8848_dir_enum dir = DRV8848_DIR_FORWARD; dir < DRV8848_DIR_CNT; dir++)
+            drv8848_set_calibration(side, dir, &test_calibrations[side][dir]);
+    TRACE("Put the robot on the floor");
+    systick_sleep_ms(5000);
+    while (1) {
+        for (uint8_t i = 0; i < ARRAY_SIZE(straight_speeds); i++) {
+            TRACE("Straight at %u", straight_speeds[i]);
+            drv8848_set_modes(DRV8848_MODE_FORWARD, straight_speeds[i], DRV8848_MODE_FORWARD, straight_speeds[i]);
+            systick_sleep_ms(1500);
+            drv8848_set_modes(DRV8848_MODE_COAST, 0, DRV8848_MODE_COAST, 0);
+            systick_sleep_ms(1000);
+            drv8848_set_modes(DRV8848_MODE_REVERSE, straight_speeds[i], DRV8848_MODE_REVERSE, straight_speeds[i]);
+            systick_sleep_ms(1500);
+            drv8848_set_modes(DRV8848_MODE_COAST, 0, DRV8848_MODE_COAST, 0);
+            systick_sleep_ms(3000);
+        }
+    }
+}
+
+static volatile uint8_t drive_test_step = 0;
+static volatile bool drive_test_escaping = false;
+
+SUPPRESS_UNUSED
+static void drive_test_done(bool completed) {
+    TRACE("Drive step %u %s", drive_test_step, completed ? "done" : "preempted");
+    drive_test_step++;
+}
+
+SUPPRESS_UNUSED
+static void drive_test_escape_done(bool completed) {
+    TRACE("Escape %s", completed ? "done" : "preempted");
+    drive_test_escaping = false;
+}
+
+/**
+ * Runs the drive primitives one after the other while the main loop keeps
+ * polling the line sensors, a line preempts the current primitive with an
+ * escape and the sequence continues with the next one once it's done
+ */
+SUPPRESS_UNUSED
+static void test_drive(void) {
+    test_setup();
+    trace_init();
+    drive_init();
+    line_init();
+    uint8_t started_step = UINT8_MAX;
+    e__line prev_line = LINE_NONE;
+    uint32_t wake_ms = systick_millis();
+    while (1) {
+        if (!drive_test_escaping && started_step != drive_test_step) {
+            started_step = drive_test_step;
+            switch (started_step % 6) {
+            case 0: drive_forward(500, 1000, drive_test_done); break;
+            case 1: drive_reverse(500, 1000, drive_test_done); break;
+            case 2: drive_pivot(DRIVE_DIR_LEFT, 400, 500, drive_test_done); break;
+            case 3: drive_arc(DRIVE_DIR_RIGHT, 600, 300, 1500, drive_test_done); break;
+            case 4: drive_spin(-180, 500, drive_test_done); break;
+            case 5: drive_spin(90, 500, drive_test_done); break;
+            }
+        }
+        const e__line line = line_get();
+        if (line != prev_line && line != LINE_NONE) {
+            // Calls back the preempted primitive (or escape) right away
+            drive_reverse(800, 300, drive_test_escape_done);
+            drive_test_escaping = true;
+        }
+        prev_line = line;
+        drive_tick();
+        systick_sleep_until(wake_ms += DRIVE_TICK_MS);
+    }
+}
+
+SUPPRESS_UNUSED
+static void drive_escape_done(bool completed) {
+    if (completed)
+        set_led(TEST_LED, LED_STATE_OFF);
+}
+
+SUPPRESS_UNUSED
+static void drive_escape_reflex(e__line line) {
+    // Runs in the ADC DMA ISR, the escape is only a lookup in flash
+    if (drive_escape(line, ESCAPE_ANGLE_UNKNOWN, drive_escape_done))
+        set_led(TEST_LED, LED_STATE_ON);
+}
+
+/**
+ * Drives forward until a line is seen, then runs its precomputed escape
+ * manoeuvre from the line reflex. The escape overrides the forward drive,
+ * which takes over again once the escape is done (and the LED is off).
+ */
+SUPPRESS_UNUSED
+static void test_drive_escape(void) {
+    test_setup();
+    trace_init();
+    led_init();
+    drive_init();
+    line_init();
+    line_register_reflex(drive_escape_reflex);
+    uint32_t wake_ms = systick_millis();
+    while (1) {
+        if (!drive_is_busy()) {
+            drive_forward(400, DRIVE_FOREVER, NULL);
+        }
+        drive_tick();
+        systick_sleep_until(wake_ms += DRIVE_TICK_MS);
+    }
+}
+
 SUPPRESS_UNUSED
 static void test_adc(void) {
     test_setup();
@@ -224,7 +781,7 @@ static void test_adc(void) {
         adc_get_channel_values(adc_values);
         for(uint8_t i = 0; i < ADC_CHANNEL_COUNT; i++) {
             TRACE("ADC Channel %u = %u", i, adc_values[i]);
-            BUSY_WAIT_ms(wait_time);
+            systick_sleep_ms(wait_time);
         }        
     }
 }
@@ -242,7 +799,7 @@ static void test_qre1113(void) {
         TRACE("Voltage front right = %u", voltages_val_buffer.front_right);
         TRACE("Voltage back left = %u", voltages_val_buffer.back_left);
         TRACE("Voltage back right = %u\n", voltages_val_buffer.back_right);
-        BUSY_WAIT_ms(wait_time);
+        systick_sleep_ms(wait_time);
     }
 }
 
@@ -254,10 +811,89 @@ static void test_line(void) {
     const uint16_t wait_time = 1000;
     while(1) {
         TRACE("Line: %u", line_get());
-        BUSY_WAIT_ms(wait_time);
+        struct line_event events[LINE_HISTORY_LEN];
+        const uint8_t event_cnt = line_get_history(events, ARRAY_SIZE(events));
+        for(uint8_t i = 0; i < event_cnt; i++) {
+            TRACE("  @%lu sensors 0x%x", events[i].timestamp, events[i].mask);
+        }
+        systick_sleep_ms(wait_time);
     }
 }
 
+SUPPRESS_UNUSED
+static void test_line_calibration(void) {
+    test_setup();
+    trace_init();
+    line_init();
+    const uint16_t wait_time = 1000;
+    const char *sensor_names[QRE1113_POS_CNT] = {"front left", "front right", "back left", "back right"};
+    TRACE("Calibrating, keep all sensors on black");
+    line_calibrate();
+    while(1) {
+        for(uint8_t i = 0; i < QRE1113_POS_CNT; i++) {
+            struct line_sensor_calibration calibration;
+            line_get_calibration((e__qre1113_pos)i, &calibration);
+            TRACE("%s: baseline %u noise %u enter %u exit %u", sensor_names[i], calibration.baseline,
+                  calibration.noise, calibration.enter_threshold, calibration.exit_threshold);
+        }
+        TRACE("Line: %u\n", line_get());
+        systick_sleep_ms(wait_time);
+    }
+}
+
+SUPPRESS_UNUSED
+static void test_line_geometry(void) {
+    test_setup();
+    trace_init();
+    line_init();
+    const uint16_t speed_hint = 500; // mm/s
+    e__line prev_line = LINE_NONE;
+    while(1) {
+        const e__line line = line_get();
+        if (line != prev_line) {
+            struct line_crossing crossing;
+            if (line_geometry_get_crossing(speed_hint, &crossing))
+                    TRACE("Line %u crossed at %d ddeg, %u mm/s", line, crossing.angle, crossing.speed);
+            else
+                    TRACE("Line %u, not enough sensors crossed", line);
+            prev_line = line;
+        }
+    }
+}
+
+SUPPRESS_UNUSED
+static void line_reflex(e__line line) {
+    // Runs in the ADC DMA ISR, reverse away from the line immediately
+    if (line == LINE_NONE) {
+        drv8848_set_mode(MOTORS_RIGHT, DRV8848_MODE_COAST, 0);
+        drv8848_set_mode(MOTORS_LEFT, DRV8848_MODE_COAST, 0);
+        set_led(TEST_LED, LED_STATE_OFF);
+    } else {
+        // Emergency, skip the slew limiter
+        drv8848_set_modes_unlimited(DRV8848_MODE_REVERSE, PWM_DUTY_MAX, DRV8848_MODE_REVERSE, PWM_DUTY_MAX);
+        set_led(TEST_LED, LED_STATE_ON);
+    }
+}
+
+/**
+ * Measure the stimulus-to-PWM latency of the line reflex with a scope:
+ * probe a qre1113 output and a motor driver input, then move the sensor over
+ * white. The PWM must change within LINE_DETECT_SEQUENCES_MAX ADC sequences
+ * (one plus the debounce) plus the ISR duration.
+ */
+SUPPRESS_UNUSED
+static void test_line_reflex(void) {
+    test_setup();
+    trace_init();
+    led_init();
+    drv8848_init();
+    line_init();
+    line_register_reflex(line_reflex);
+    TRACE("Line reflex latency bound: %lu us + ISR",
+          LINE_DETECT_SEQUENCES_MAX * ADC_SEQUENCE_PERIOD_US);
+    while(1);
+}
+
 SUPPRESS_UNUSED
 static void test_i2c_read(void) {
     test_setup();
@@ -265,7 +901,7 @@ static void test_i2c_read(void) {
     i2c_init();
     const uint16_t wait_time = 1000;
     io_set_out(XSHUT_MIDDLE, IO_OUT_HIGH); // Set XSHUT of laser sensor high to turn on device
-    BUSY_WAIT_ms(1000); // Wait for laser sensor to get out of standby mode/turn on
+    systick_sleep_ms(1000); // Wait for laser sensor to get out of standby mode/turn on
     i2c_set_slave_address(0x29);
     while(1) {
         uint8_t vl53l0xid = 0;
@@ -276,7 +912,7 @@ static void test_i2c_read(void) {
                 TRACE("Read expected VL53L0X ID (0xEE)");
         else
                 TRACE("Read unexpected VL53L0X ID 0x%X (Expected 0xEE)", vl53l0xid);
-    BUSY_WAIT_ms(wait_time);
+    systick_sleep_ms(wait_time);
     }    
 }
 
@@ -291,7 +927,7 @@ static void test_i2c_write(void) {
     trace_init();
     i2c_init();
     io_set_out(XSHUT_MIDDLE, IO_OUT_HIGH); // Set XSHUT of laser sensor high to turn on device
-    BUSY_WAIT_ms(1000); // Wait for laser sensor to get out of standby mode/turn on
+    systick_sleep_ms(1000); // Wait for laser sensor to get out of standby mode/turn on
     i2c_set_slave_address(0x29);
     while(1) {
         // Write value to register
@@ -307,7 +943,7 @@ static void test_i2c_write(void) {
                 TRACE("Read expected VL53L0X ID (0x%X)", write_val); // Read expected value
         else
                 TRACE("Read unexpected VL53L0X ID 0x%X (Expected 0x%X)", read_val, write_val); // Did not read expected value
-    BUSY_WAIT_ms(wait_time);
+    systick_sleep_ms(wait_time);
     }    
 }
 
@@ -329,7 +965,7 @@ static void test_vl53l0x(void) {
             else
                     TRACE("Out of range");
         }
-        BUSY_WAIT_ms(1000);
+        systick_sleep_ms(1000);
     }
 }
 
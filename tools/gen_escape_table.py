@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""
+Generates src/fw/app/escape_table.c, the precomputed line escape manoeuvres
+executed by drive_escape().
+
+Every entry of the table is a sequence of (left speed, right speed, duration)
+segments indexed by the line event (e__line) and the crossing angle bin, so
+nothing has to be computed when the line is detected. The manoeuvres are
+described by the parameters below, edit them and rerun:
+
+    python3 tools/gen_escape_table.py > src/fw/app/escape_table.c
+"""
+
+# Speeds are in permille (MOTORS_SPEED_MAX), durations in ms
+REVERSE_SPEED = 900
+REVERSE_MS = 200
+FORWARD_SPEED = 900
+FORWARD_MS = 250
+SPIN_SPEED = 800
+# Rate the robot spins in place at full speed (DRIVE_SPIN_DEG_PER_S_FULL_SPEED)
+SPIN_DEG_PER_S_FULL_SPEED = 720
+ARC_INNER_RATIO = 300  # Permille of the outer wheel speed, as drive_arc()
+ARC_MS = 300
+# Spin used when only one sensor crossed the line and the angle is unknown
+SINGLE_SENSOR_SPIN_DEG = 135
+
+# Crossing angle bins in deci-degrees (>0 left sensor crossed first), must
+# match ESCAPE_ANGLE_BIN_CNT and ESCAPE_ANGLE_BIN_WIDTH in escape_table.h
+ANGLE_BIN_WIDTH = 300
+ANGLE_BIN_CNT = 5
+
+# In the order of e__line in app/line.h
+LINES = [
+    "LINE_NONE",
+    "LINE_FRONT",
+    "LINE_BACK",
+    "LINE_LEFT",
+    "LINE_RIGHT",
+    "LINE_FRONT_LEFT",
+    "LINE_FRONT_RIGHT",
+    "LINE_BACK_LEFT",
+    "LINE_BACK_RIGHT",
+    "LINE_DIAGONAL_LEFT",
+    "LINE_DIAGONAL_RIGHT",
+]
+
+
+def bin_center_deg(angle_bin):
+    """Center of an angle bin in degrees"""
+    return (angle_bin - ANGLE_BIN_CNT // 2) * ANGLE_BIN_WIDTH / 10
+
+
+def reverse():
+    return (-REVERSE_SPEED, -REVERSE_SPEED, REVERSE_MS)
+
+
+def forward():
+    return (FORWARD_SPEED, FORWARD_SPEED, FORWARD_MS)
+
+
+def spin(deg):
+    """Spin in place, positive is left (counterclockwise)"""
+    full_speed_ms = abs(deg) * 1000 / SPIN_DEG_PER_S_FULL_SPEED
+    ms = round(full_speed_ms * 1000 / SPIN_SPEED)
+    if deg > 0:
+        return (-SPIN_SPEED, SPIN_SPEED, max(ms, 1))
+    return (SPIN_SPEED, -SPIN_SPEED, max(ms, 1))
+
+
+def arc(left):
+    """Drive forward while turning to the given side"""
+    inner = FORWARD_SPEED * ARC_INNER_RATIO // 1000
+    if left:
+        return (inner, FORWARD_SPEED, ARC_MS)
+    return (FORWARD_SPEED, inner, ARC_MS)
+
+
+def turn_away(angle_deg):
+    """
+    Spin so the robot faces away from a line it drove onto head-first. A
+    positive crossing angle (left sensor first) means the robot is turned
+    clockwise relative to the line normal, so turning right is shorter.
+    """
+    if angle_deg >= 0:
+        return spin(-(180 - angle_deg))
+    return spin(180 + angle_deg)
+
+
+def manoeuvre(line, angle_bin):
+    angle = bin_center_deg(angle_bin)
+    if line == "LINE_NONE":
+        return []
+    if line == "LINE_FRONT":
+        return [reverse(), turn_away(angle), forward()]
+    if line == "LINE_BACK":
+        # Backed onto the line, drive away and straighten up towards the center
+        if angle:
+            return [forward(), spin(angle / 2)]
+        return [forward()]
+    if line == "LINE_LEFT":
+        return [arc(left=False), forward()]
+    if line == "LINE_RIGHT":
+        return [arc(left=True), forward()]
+    if line == "LINE_FRONT_LEFT":
+        return [reverse(), spin(-SINGLE_SENSOR_SPIN_DEG), forward()]
+    if line == "LINE_FRONT_RIGHT":
+        return [reverse(), spin(SINGLE_SENSOR_SPIN_DEG), forward()]
+    if line == "LINE_BACK_LEFT":
+        return [arc(left=False), forward()]
+    if line == "LINE_BACK_RIGHT":
+        return [arc(left=True), forward()]
+    if line == "LINE_DIAGONAL_LEFT":
+        return [spin(-90), forward()]
+    if line == "LINE_DIAGONAL_RIGHT":
+        return [spin(90), forward()]
+    raise ValueError(line)
+
+
+def main():
+    sequences = {}  # Segments -> name, identical manoeuvres are emitted once
+    table = []
+    for line in LINES:
+        row = []
+        for angle_bin in range(ANGLE_BIN_CNT):
+            segments = tuple(manoeuvre(line, angle_bin))
+            if segments and segments not in sequences:
+                sequences[segments] = "escape_{}_{}".format(
+                    line[len("LINE_"):].lower(), angle_bin)
+            row.append(segments)
+        table.append(row)
+
+    print("// Generated by tools/gen_escape_table.py, do not edit")
+    print('#include "app/escape_table.h"')
+    print("#include <assert.h>")
+    print("#include <stddef.h>")
+    print()
+    checks = [
+        ("ESCAPE_LINE_CNT", len(LINES)),
+        ("ESCAPE_ANGLE_BIN_CNT", ANGLE_BIN_CNT),
+        ("ESCAPE_ANGLE_BIN_WIDTH", ANGLE_BIN_WIDTH),
+    ]
+    for define, value in checks:
+        print('static_assert({} == {}, "Out of sync with generator");'.format(
+            define, value))
+    print()
+    for segments, name in sequences.items():
+        print("static const struct drive_segment {}[] = {{".format(name))
+        for left, right, ms in segments:
+            print("    {{{}, {}, {}}},".format(left, right, ms))
+        print("};")
+    print()
+    print("const struct escape_entry")
+    print("    escape_table[ESCAPE_LINE_CNT][ESCAPE_ANGLE_BIN_CNT] = {")
+    for line, row in zip(LINES, table):
+        print("    [{}] = {{".format(line))
+        for segments in row:
+            if segments:
+                print("        {{{}, {}}},".format(sequences[segments],
+                                                 len(segments)))
+            else:
+                print("        {NULL, 0},")
+        print("    },")
+    print("};")
+
+
+if __name__ == "__main__":
+    main()
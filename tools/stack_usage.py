@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""
+Reports the worst-case stack usage of every entry point of the firmware (main
+and the ISRs) and fails if the worst case doesn't fit in the RAM between the
+heap and the end of RAM, where the stack lives:
+
+    make HW=LAUNCHPAD stack
+
+The stack usage of every function comes from the .su files gcc writes with
+-fstack-usage, the call graph from the disassembly of the linked ELF. Calls
+through a function pointer (callbacks, event handlers, scheduler tasks) are
+assumed to reach the deepest function whose address is taken anywhere in the
+code or data. ISRs don't nest, so the worst case is main plus the deepest ISR.
+"""
+
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+
+RETURN_ADDRESS_BYTES = 2  # Pushed by call (small memory model)
+INTERRUPT_FRAME_BYTES = 4  # PC and SR pushed on interrupt entry
+# Functions without a .su file (libc and libgcc), none of them go deep
+UNKNOWN_FUNCTION_BYTES = 32
+# Heap allocated at init (the UART ring buffer) and malloc's bookkeeping
+HEAP_RESERVE_BYTES = 128
+
+INDIRECT = "<indirect call>"
+
+FUNCTION_RE = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+IMMEDIATE_RE = re.compile(r"#(-?(?:0x[0-9a-f]+|\d+))")
+
+
+def run(cmd):
+    return subprocess.run(cmd, check=True, capture_output=True,
+                          text=True).stdout
+
+
+def read_stack_usage(obj_dir):
+    """Function name -> (bytes, qualifiers) from the .su files"""
+    usage = {}
+    paths = glob.glob(os.path.join(obj_dir, "**", "*.su"), recursive=True)
+    if not paths:
+        sys.exit("No .su files in {}, build with -fstack-usage".format(
+            obj_dir))
+    for path in paths:
+        with open(path) as su_file:
+            for line in su_file:
+                location, size, qualifiers = line.rstrip("\n").split("\t")
+                name = location.split(":")[-1]
+                # Static functions of different files may share a name
+                if name not in usage or int(size) > usage[name][0]:
+                    usage[name] = (int(size), qualifiers)
+    return usage
+
+
+def parse_immediate(text):
+    value = int(text, 0) if text.lstrip("-").startswith("0x") else int(text)
+    return value & 0xFFFFF
+
+
+def read_disassembly(objdump, elf):
+    """
+    Returns the calls of every function (None for an indirect call), the
+    function start addresses, the ISRs and the immediates of the other
+    instructions (possibly function addresses)
+    """
+    calls = {}
+    starts = {}
+    isrs = set()
+    immediates = set()
+    function = None
+    for line in run([objdump, "-d", elf]).splitlines():
+        match = FUNCTION_RE.match(line)
+        if match:
+            function = match.group(2)
+            starts[int(match.group(1), 16)] = function
+            calls[function] = []
+            continue
+        fields = line.split("\t")
+        if function is None or len(fields) < 3 or not fields[0].endswith(":"):
+            continue
+        mnemonic = fields[2].strip()
+        operands = fields[3] if len(fields) > 3 else ""
+        values = [parse_immediate(v) for v in IMMEDIATE_RE.findall(operands)]
+        if mnemonic == "reti":
+            isrs.add(function)
+        elif mnemonic in ("call", "calla"):
+            calls[function].append(values[0] if values else None)
+        elif mnemonic in ("br", "bra") and values:
+            calls[function].append(values[0])  # Tail call (or a jump)
+        else:
+            immediates.update(values)
+    return calls, starts, isrs, immediates
+
+
+def read_data_words(objdump, elf):
+    """Every 16-bit word of the initialized data (tables of function pointers
+    and the vector table)"""
+    words = set()
+    for line in run([objdump, "-s", "-j", ".rodata", "-j", ".data",
+                     elf]).splitlines():
+        fields = line.split()
+        if len(fields) < 2 or not re.fullmatch(r"[0-9a-f]{4,}", fields[0]):
+            continue
+        data = "".join(f for f in fields[1:5]
+                       if re.fullmatch(r"[0-9a-f]{2,8}", f))
+        for i in range(0, len(data) - 3, 4):
+            words.add(int(data[i + 2:i + 4] + data[i:i + 2], 16))
+    return words
+
+
+def read_symbols(readelf, elf):
+    symbols = {}
+    for line in run([readelf, "-sW", elf]).splitlines():
+        fields = line.split()
+        if len(fields) == 8 and fields[0][:-1].isdigit():
+            symbols[fields[7]] = int(fields[1], 16)
+    return symbols
+
+
+class CallGraph:
+    def __init__(self, usage, calls, starts, indirect_targets):
+        self.usage = usage
+        self.indirect_targets = indirect_targets
+        self.callees = {}
+        for function, addresses in calls.items():
+            callees = []
+            for address in addresses:
+                if address is None:
+                    callees.append(INDIRECT)
+                elif address in starts and starts[address] != function:
+                    callees.append(starts[address])
+            self.callees[function] = sorted(set(callees))
+        self.worst = {}
+        self.unknown = set()
+        self.dynamic = set()
+        self.recursion = set()
+
+    def frame(self, function):
+        if function == INDIRECT:
+            return 0
+        name = function if function in self.usage else function.split(".")[0]
+        if name not in self.usage:
+            self.unknown.add(function)
+            return UNKNOWN_FUNCTION_BYTES
+        size, qualifiers = self.usage[name]
+        if "dynamic" in qualifiers and "bounded" not in qualifiers:
+            self.dynamic.add(function)
+        return size
+
+    def worst_case(self, function, path=()):
+        """
+        (bytes, deepest call chain, whether it was cut short by recursion) of
+        function and everything it calls
+        """
+        if function in self.worst:
+            return self.worst[function]
+        if function in path:
+            self.recursion.add(" -> ".join(path + (function,)))
+            return 0, [], True
+        # Only concrete functions go on the path, a function pointer call below
+        # another one is expanded again rather than taken for recursion
+        if function == INDIRECT:
+            callees = self.indirect_targets
+            callee_path = path
+        else:
+            callees = self.callees.get(function, [])
+            callee_path = path + (function,)
+        deepest = (0, [])
+        cut = False
+        for callee in callees:
+            size, chain, callee_cut = self.worst_case(callee, callee_path)
+            cut = cut or callee_cut
+            if callee != INDIRECT:
+                size += RETURN_ADDRESS_BYTES
+            if size > deepest[0]:
+                deepest = (size, chain)
+        result = (self.frame(function) + deepest[0], [function] + deepest[1],
+                  cut)
+        # Results cut short depend on the path they were reached by
+        if not cut:
+            self.worst[function] = result
+        return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("elf")
+    parser.add_argument("obj_dir", help="where the .su files are")
+    parser.add_argument("--objdump", default="msp430-elf-objdump")
+    parser.add_argument("--readelf", default="msp430-elf-readelf")
+    parser.add_argument("--heap", type=int, default=HEAP_RESERVE_BYTES,
+                        help="bytes of heap to leave free")
+    parser.add_argument("-v", "--verbose", action="store_true",
+                        help="print the deepest call chain of every entry")
+    args = parser.parse_args()
+
+    usage = read_stack_usage(args.obj_dir)
+    calls, starts, isrs, immediates = read_disassembly(args.objdump, args.elf)
+    address_taken = immediates | read_data_words(args.objdump, args.elf)
+    indirect_targets = sorted(name for address, name in starts.items()
+                              if address in address_taken and
+                              name not in isrs)
+    graph = CallGraph(usage, calls, starts, indirect_targets)
+
+    entries = [("main", 0)] + [(isr, INTERRUPT_FRAME_BYTES)
+                               for isr in sorted(isrs)]
+    print("{:<32} {:>6}".format("Entry point", "Bytes"))
+    worst_isr = 0
+    for entry, frame_bytes in entries:
+        size, chain, _ = graph.worst_case(entry)
+        size += frame_bytes
+        if entry != "main":
+            worst_isr = max(worst_isr, size)
+        print("{:<32} {:>6}".format(entry, size))
+        if args.verbose:
+            print("    " + " -> ".join(chain))
+
+    main_size = graph.worst_case("main")[0]
+    symbols = read_symbols(args.readelf, args.elf)
+    heap_start = symbols.get("end", symbols.get("__heap_start__"))
+    budget = symbols["__stack"] - heap_start - args.heap
+    total = main_size + worst_isr
+    print("Worst case {} bytes (main {} + ISR {}), budget {} bytes".format(
+        total, main_size, worst_isr, budget))
+    if graph.unknown:
+        print("Assumed {} bytes for: {}".format(
+            UNKNOWN_FUNCTION_BYTES, ", ".join(sorted(graph.unknown))))
+    if graph.recursion:
+        print("Recursion (counted once):\n    " +
+              "\n    ".join(sorted(graph.recursion)))
+    errors = []
+    if graph.dynamic:
+        errors.append("Unbounded stack in: " +
+                      ", ".join(sorted(graph.dynamic)))
+    if total > budget:
+        errors.append("Stack budget exceeded by {} bytes".format(
+            total - budget))
+    for error in errors:
+        print(error, file=sys.stderr)
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())